@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,14 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks do not
+// contend. brelse() stamps a buffer with the time it became
+// unused; a miss recycles the unused buffer with the oldest
+// stamp. Only misses take bcache.lock, which serializes
+// eviction so that two processes cannot both insert a buffer
+// for the same block.
 
 
 #include "types.h"
@@ -23,33 +31,120 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock; // serializes eviction
   struct buf buf[NBUF];
+  uint64 misses;        // bget()s that recycled a buffer; under lock
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Hash buckets of buffers, each a list through prev/next.
+  struct {
+    struct spinlock lock;
+    struct buf head;
+    uint64 hits;        // bget()s that found their block here
+  } bucket[NBUCKET];
 } bcache;
 
+static void brelse_unlocked(struct buf *b);
+
+// Remove b from its bucket list. Caller holds the bucket lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the head of list head. Caller holds the bucket lock.
+static void
+binsert(struct buf *head, struct buf *b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++){
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head.prev = &bcache.bucket[i].head;
+    bcache.bucket[i].head.next = &bcache.bucket[i].head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // All buffers start out unused, in bucket 0.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binsert(&bcache.bucket[0].head, b);
+  }
+}
+
+// Look for block blockno on device dev in bucket h.
+// Caller holds the bucket lock.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head.next; b != &bcache.bucket[h].head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Remove the least recently used (LRU) unused buffer from its
+// bucket and return it, or return 0 if no more than keep
+// buffers are unused. Keeps holding the lock of the bucket
+// that contains the best candidate so far; buckets are locked
+// in index order. Caller holds bcache.lock.
+static struct buf*
+brecycle(int keep)
+{
+  struct buf *b, *lru;
+  int i, lrubucket, nunused;
+
+  lru = 0;
+  lrubucket = -1;
+  nunused = 0;
+  for(i = 0; i < NBUCKET; i++){
+    acquire(&bcache.bucket[i].lock);
+    int found = 0;
+    for(b = bcache.bucket[i].head.next; b != &bcache.bucket[i].head; b = b->next){
+      if(b->refcnt != 0)
+        continue;
+      nunused++;
+      if(lru == 0 || b->timestamp < lru->timestamp){
+        lru = b;
+        found = 1;
+      }
+    }
+    if(found){
+      if(lrubucket >= 0)
+        release(&bcache.bucket[lrubucket].lock);
+      lrubucket = i;
+    } else {
+      release(&bcache.bucket[i].lock);
+    }
+  }
+  if(lru == 0)
+    return 0;
+  if(nunused <= keep){
+    release(&bcache.bucket[lrubucket].lock);
+    return 0;
   }
+
+  bunlink(lru);
+  release(&bcache.bucket[lrubucket].lock);
+  return lru;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +154,52 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  int h;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0){
+    b->refcnt++;
+    bcache.bucket[h].hits++;
+  }
+  release(&bcache.bucket[h].lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Another process may have inserted it
+  // since we looked, so check again holding the eviction lock.
+  acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0){
+    b->refcnt++;
+    bcache.bucket[h].hits++;
   }
-  panic("bget: no buffers");
+  release(&bcache.bucket[h].lock);
+  if(b){
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Recycle the least recently used unused buffer.
+  if((b = brecycle(0)) == 0)
+    panic("bget: no buffers");
+  bcache.misses++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  acquire(&bcache.bucket[h].lock);
+  binsert(&bcache.bucket[h].head, b);
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +216,75 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading blocks blocknos[0..n-1] into the cache without
+// waiting for them, skipping blocks that are cached already.
+// Read-ahead must not starve bget(), so this stops once no
+// more than a quarter of the buffers are unused. The reads go
+// to the disk in batches; the disk driver calls bdone() as
+// each one finishes.
+void
+bprefetch(uint dev, uint *blocknos, int n)
+{
+  struct buf *b, *batch[8];
+  int h, i, nbatch;
+
+  nbatch = 0;
+  for(i = 0; i < n; i++){
+    h = BHASH(dev, blocknos[i]);
+    acquire(&bcache.bucket[h].lock);
+    b = bfind(h, dev, blocknos[i]);
+    release(&bcache.bucket[h].lock);
+    if(b)
+      continue;
+
+    acquire(&bcache.lock);
+    acquire(&bcache.bucket[h].lock);
+    b = bfind(h, dev, blocknos[i]);
+    release(&bcache.bucket[h].lock);
+    if(b){
+      release(&bcache.lock);
+      continue;
+    }
+    if((b = brecycle(NBUF/4)) == 0){
+      release(&bcache.lock);
+      break;
+    }
+    // b is unused and in no bucket, so this does not block. Lock
+    // it before it becomes visible, so that a bread() of the same
+    // block waits for the read instead of racing with it.
+    acquiresleep(&b->lock);
+    b->dev = dev;
+    b->blockno = blocknos[i];
+    b->valid = 0;
+    b->refcnt = 1;
+    acquire(&bcache.bucket[h].lock);
+    binsert(&bcache.bucket[h].head, b);
+    release(&bcache.bucket[h].lock);
+    release(&bcache.lock);
+
+    b->async = 1;
+    batch[nbatch++] = b;
+    if(nbatch == NELEM(batch)){
+      virtio_disk_start(batch, nbatch, 0);
+      nbatch = 0;
+    }
+  }
+  if(nbatch > 0)
+    virtio_disk_start(batch, nbatch, 0);
+}
+
+// Called by the disk driver, in interrupt context, when a
+// read started by bprefetch() has finished. Unlocks and
+// releases the buffer on behalf of the prefetching process.
+void
+bdone(struct buf *b)
+{
+  b->async = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  brelse_unlocked(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +294,21 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the n bufs in bs[] to disk, letting the disk work on
+// all of them at once. All must be locked.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  }
+  virtio_disk_rwv(bs, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +316,62 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  brelse_unlocked(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to a buffer whose sleep-lock is not held.
+// If no one else is using it, record when it became unused.
+static void
+brelse_unlocked(struct buf *b)
+{
+  int h;
+
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->timestamp = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  if(b->refcnt == 0)
+    b->timestamp = ticks;
+  release(&bcache.bucket[h].lock);
 }
 
 
+
+// Buffer cache hits and misses since boot. The counts are
+// read without locks, so may be slightly stale.
+uint64
+count_bcache_hits(void)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < NBUCKET; i++)
+    n += __atomic_load_n(&bcache.bucket[i].hits, __ATOMIC_RELAXED);
+  return n;
+}
+
+uint64
+count_bcache_misses(void)
+{
+  return __atomic_load_n(&bcache.misses, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,150 @@
+// Buddy allocator for physical memory.
+//
+// Manages KERNBASE..PHYSTOP as blocks of 2^order pages, for
+// order 0 .. NORDER-1, each aligned to its own size. A free
+// block of each order is kept on that order's free list.
+// buddyalloc() takes the smallest free block that is large
+// enough and splits it, putting the unused halves back on
+// the lower orders' lists. buddyfree() merges a block with
+// its buddy, the other half of the block of the next order
+// up, for as long as the buddy is free too.
+//
+// kalloc() does not come here for every page: each CPU keeps
+// a cache of single pages, and moves pages between it and
+// the buddy allocator in batches.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PG2PA(pg) (KERNBASE + (uint64)(pg) * PGSIZE)
+
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block head[NORDER];  // circular free lists, one per order
+  int nblock[NORDER];         // blocks on each list
+  uint64 nfree;               // free pages, in blocks of any order
+  // freeorder[pg] is order+1 if page pg starts a free block
+  // of that order, and 0 otherwise.
+  uchar freeorder[NPAGES];
+} buddy;
+
+static void
+blkpush(struct block *b, int order)
+{
+  struct block *h = &buddy.head[order];
+
+  b->next = h->next;
+  b->prev = h;
+  h->next->prev = b;
+  h->next = b;
+  buddy.freeorder[PA2PG(b)] = order + 1;
+  buddy.nblock[order]++;
+}
+
+static void
+blkunlink(struct block *b, int order)
+{
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.freeorder[PA2PG(b)] = 0;
+  buddy.nblock[order]--;
+}
+
+// Give the buddy allocator the pages in [start, end).
+void
+buddyinit(void *start, void *end)
+{
+  char *p;
+
+  initlock(&buddy.lock, "buddy");
+  for(int i = 0; i < NORDER; i++)
+    buddy.head[i].next = buddy.head[i].prev = &buddy.head[i];
+  for(p = (char*)PGROUNDUP((uint64)start); p + PGSIZE <= (char*)end; p += PGSIZE)
+    buddyfree(p, 0);
+}
+
+// Allocate 2^order contiguous pages, aligned to their size.
+// Returns 0 if no block that large is free.
+void *
+buddyalloc(int order)
+{
+  struct block *b;
+  int k;
+
+  if(order < 0 || order >= NORDER)
+    panic("buddyalloc");
+
+  acquire(&buddy.lock);
+  for(k = order; k < NORDER && buddy.nblock[k] == 0; k++)
+    ;
+  if(k == NORDER){
+    release(&buddy.lock);
+    return 0;
+  }
+  b = buddy.head[k].next;
+  blkunlink(b, k);
+  // split, keeping the lower half each time.
+  while(k > order){
+    k--;
+    blkpush((struct block*)((char*)b + (PGSIZE << k)), k);
+  }
+  buddy.nfree -= 1L << order;
+  release(&buddy.lock);
+  return (void*)b;
+}
+
+// Free a block of 2^order pages from buddyalloc(), merging
+// it with its buddies.
+void
+buddyfree(void *pa, int order)
+{
+  uint64 pg, bpg;
+
+  if(order < 0 || order >= NORDER || (uint64)pa % (PGSIZE << order) != 0 ||
+     (uint64)pa < KERNBASE || (uint64)pa >= PHYSTOP)
+    panic("buddyfree");
+
+  pg = PA2PG(pa);
+  acquire(&buddy.lock);
+  buddy.nfree += 1L << order;
+  for(; order < NORDER - 1; order++){
+    bpg = pg ^ (1L << order);
+    if(buddy.freeorder[bpg] != order + 1)
+      break;
+    blkunlink((struct block*)PG2PA(bpg), order);
+    if(bpg < pg)
+      pg = bpg;
+  }
+  blkpush((struct block*)PG2PA(pg), order);
+  release(&buddy.lock);
+}
+
+// Free pages held by the buddy allocator.
+uint64
+buddyfreepages(void)
+{
+  return __atomic_load_n(&buddy.nfree, __ATOMIC_RELAXED);
+}
+
+// Copy the number of free blocks of each order to n[].
+// Many small blocks and few large ones mean that memory is
+// fragmented.
+void
+buddystats(uint64 *n)
+{
+  acquire(&buddy.lock);
+  for(int i = 0; i < NORDER; i++)
+    n[i] = buddy.nblock[i];
+  release(&buddy.lock);
+}
@@ -16,6 +16,11 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bwritev(struct buf**, int);
+void            bprefetch(uint, uint*, int);
+void            bdone(struct buf*);
+uint64          count_bcache_hits(void);
+uint64          count_bcache_misses(void);
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +38,7 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int, int);
 
 // fs.c
 void            fsinit(int);
@@ -52,6 +58,8 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
+int             writeipipe(struct inode*, struct pipe*, uint, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -59,10 +67,25 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// buddy.c
+void            buddyinit(void*, void*);
+void*           buddyalloc(int);
+void            buddyfree(void*, int);
+uint64          buddyfreepages(void);
+void            buddystats(uint64*);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void*           kalloc_mega(void);
+void            kfree_mega(void *);
+int             kzero(void);
 void            kfree(void *);
 void            kinit(void);
+void            krefinc(void *);
+int             krefcnt(void *);
 uint64          count_free_memory(void);
 
 // log.c
@@ -70,18 +93,34 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_tick(void);
+void            log_force(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipewaitread(struct pipe*);
+int             pipewaitwrite(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
+int             pipeget(struct pipe*, char*, int);
+int             pipesplice(struct pipe*, struct pipe*, int, int);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+void            profile(int);
+int             profdrain(uint64, int, uint64*);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
@@ -97,23 +136,39 @@ struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            makerunnable(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             kthread(void (*)(void), char*);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             tracing(int);
 uint64          count_proc_not_UNUSED(void);
+uint64          count_context_switches(int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopy(void*, void*, uint64);
+int             ucopystr(char*, char*, uint64);
+
+// slab.c
+struct kmem_cache;
+void            kmem_cache_init(struct kmem_cache*, char*, uint, void (*)(void*), void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+int             lockstats(uint64, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -159,14 +214,23 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
+void            kvmswitch(struct proc*);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(struct proc*);
+int             uvmfault(struct proc*, uint64, int);
+int             vmfault(pagetable_t, uint64, uint64, int);
+uint64          count_page_faults(void);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
@@ -179,10 +243,20 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// trace.c
+struct traceent;
+void            traceinit(void);
+void            tracerecord(struct traceent*, int);
+int             tracedrain(uint64, int, uint64*);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_start(struct buf **, int, int);
 void            virtio_disk_intr(void);
+uint64          count_disk_reads(void);
+uint64          count_disk_writes(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -12,17 +12,23 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// Open files are allocated from filecache; ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
 
+static struct kmem_cache filecache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kmem_cache_init(&filecache, "file", sizeof(struct file), 0, 0);
 }
 
 // Allocate a file structure.
@@ -31,16 +37,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(&filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +73,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(&filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -129,6 +131,22 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// The most bytes one transaction may write to a file.
+static int
+writemax(void)
+{
+  return ((log_maxop()-1-1-2) / 2) * BSIZE;
+}
+
+// Log blocks to reserve for writing n bytes to a file: the
+// data blocks, plus the i-node, indirect block, allocation
+// blocks, and 2 blocks of slop for non-aligned writes.
+static int
+writelog(int n)
+{
+  return 1+1+2 + 2*((n + BSIZE - 1) / BSIZE);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,25 +164,25 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write many blocks at a time, reserving log space
+    // in proportion to the size of each chunk, but
+    // without exceeding the maximum reservation.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = writemax();
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nlog = writelog(n1);
 
-      begin_op();
+      begin_opn(nlog);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nlog);
 
       if(r != n1){
         // error from writei
@@ -180,3 +198,68 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Move up to n bytes from file in to file out without a copy
+// through user space. One file must be a pipe, and the other a
+// pipe or an inode. Consumes the data from in if consume is
+// set (splice); otherwise in and out must both be pipes, and
+// in's reader still sees the data (tee). Like read(), may move
+// fewer than n bytes. Returns the number of bytes moved, 0 at
+// the end of in, or -1 on error.
+int
+filesplice(struct file *in, struct file *out, int n, int consume)
+{
+  int r;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  if(in->type == FD_PIPE && out->type == FD_PIPE)
+    return pipesplice(in->pipe, out->pipe, n, consume);
+  if(!consume)
+    return -1;
+
+  // in both cases below, another reader or writer of the pipe
+  // may drain or fill it between the wait and the copy, so a
+  // copy of 0 bytes means wait again, not end of file.
+  if(n == 0)
+    return 0;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    for(;;){
+      if(pipewaitwrite(out->pipe) < 0)
+        return -1;
+      ilock(in->ip);
+      int eof = in->off >= in->ip->size;
+      if((r = readipipe(in->ip, out->pipe, in->off, n)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      if(r != 0 || eof)
+        return r;
+    }
+  }
+
+  if(in->type == FD_PIPE && out->type == FD_INODE){
+    for(;;){
+      // wait for data outside the transaction, since the pipe's
+      // writer may take arbitrarily long.
+      if((r = pipewaitread(in->pipe)) <= 0)
+        return r;
+      int n1 = n;
+      if(n1 > r)
+        n1 = r;
+      if(n1 > writemax())
+        n1 = writemax();
+      int nlog = writelog(n1);
+      begin_opn(nlog);
+      ilock(out->ip);
+      if((r = writeipipe(out->ip, in->pipe, out->off, n1)) > 0)
+        out->off += r;
+      iunlock(out->ip);
+      end_opn(nlog);
+      if(r != 0)
+        return r;
+    }
+  }
+
+  return -1;
+}
@@ -18,8 +18,12 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // next in itable hash chain
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // read-ahead: block a sequential read starts at
+  uint rawin;         // read-ahead: window, in blocks
+  uint raend;         // read-ahead: blocks below this were prefetched
 
   short type;         // copy of disk inode
   short major;
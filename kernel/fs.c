@@ -18,6 +18,7 @@
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
+#include "slab.h"
 #include "buf.h"
 #include "file.h"
 
@@ -163,28 +164,49 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries. In-memory inodes come from inodecache and are
+// found through a hash table on (dev, inum); an inode is
+// freed when its last reference goes away. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and
+// ip->inum indicate which i-node an entry holds, one must
+// hold itable.lock while using any of those fields, or
+// ip->hnext.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // in-use inodes, through hnext
 } itable;
 
+static struct kmem_cache inodecache;
+
+// An inode's sleep lock is set up once, when the inode cache
+// carves a new page, rather than on every iget(): initlock()
+// registers the lock for lockstats(), which takes a scan.
+static void
+inodector(void *obj)
+{
+  initsleeplock(&((struct inode*)obj)->lock, "inode");
+}
+
+static void
+inodedtor(void *obj)
+{
+  freelock(&((struct inode*)obj)->lock.lk);
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&inodecache, "inode", sizeof(struct inode),
+                  inodector, inodedtor);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -242,31 +264,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Allocate a new inode entry.
+  if((ip = kmem_cache_alloc(&inodecache)) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->rawin = 0;
+  ip->raend = 0;
   release(&itable.lock);
 
   return ip;
@@ -323,8 +346,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -332,6 +355,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
@@ -353,8 +378,15 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&itable.lock);
+    return;
+  }
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
   release(&itable.lock);
+  kmem_cache_free(&inodecache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -448,6 +480,44 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead. Each inode remembers the block where its last
+// read ended. A read that carries on from there is sequential
+// and doubles the inode's read-ahead window, from RAMIN up to
+// RAMAX blocks; any other read closes the window. Blocks in
+// the window are handed to bprefetch(), which starts the disk
+// reads without waiting for them.
+#define RAMIN 2
+#define RAMAX 16
+
+// Called by readi() before it reads blocks first..last.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end, nblocks, blocks[RAMAX];
+  int n;
+
+  if(first == ip->ranext || first + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : RAMIN;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = min(last + 1 + ip->rawin, nblocks);
+  bn = ip->raend > last + 1 ? ip->raend : last + 1;
+  for(n = 0; bn < end && n < RAMAX; bn++)
+    blocks[n++] = bmap(ip, bn);
+  end = bn;
+  bprefetch(ip->dev, blocks, n);
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -462,6 +532,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0 && ip->type == T_FILE)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -516,6 +588,75 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// Copy up to n bytes of ip, starting at offset off, into
+// pipe pi straight from the buffer cache, as many as pi has
+// room for. Returns the number of bytes copied, or -1 if
+// pi's read side is closed.
+// Caller must hold ip->lock.
+int
+readipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if(n > 0 && ip->type == T_FILE)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(pi, (char*)bp->data + (off % BSIZE), m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
+// Copy up to n bytes out of pipe pi into ip at offset off,
+// straight into the buffer cache, as many as pi has ready.
+// Returns the number of bytes copied, or -1 on error.
+// Caller must hold ip->lock and be in a transaction.
+int
+writeipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  for(tot=0; tot<n; tot+=m, off+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if((m = pipeget(pi, (char*)bp->data + (off % BSIZE), m)) == 0){
+      brelse(bp);
+      break;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+
+  if(off > ip->size)
+    ip->size = off;
+
+  // bmap() may have added a block to ip->addrs[].
+  iupdate(ip);
+
+  return tot;
+}
+
 // Directories
 
 int
@@ -1,6 +1,39 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and runs of 2^order pages.
+//
+// Memory belongs to the buddy allocator in buddy.c, which
+// hands out and coalesces blocks of any order. Each CPU also
+// keeps its own cache of free pages, so kalloc() and kfree()
+// normally only touch the running CPU's list and lock, which
+// no other CPU takes unless it has run dry. A CPU whose list
+// is empty takes a block of KBATCH pages from the buddy
+// allocator, or, if that fails, steals a batch of pages from
+// the CPU with the most free pages. kfree() gives KBATCH
+// pages back to the buddy allocator once a CPU caches more
+// than KCACHE, so that they can be coalesced.
+//
+// Pages can be shared copy-on-write between page tables, so
+// each physical page has a reference count. kalloc() sets it
+// to 1, krefinc() adds a reference, and kfree() only puts the
+// page back on a free list when the last reference is dropped.
+//
+// Each CPU also keeps a pool of up to ZPOOL free pages that
+// are known to be zero. kzero() fills it, a page at a time,
+// from scheduler() when the CPU has nothing to run, so that
+// kalloc_zeroed() can usually return a zeroed page without
+// zeroing it. kalloc() takes from the pool only when the
+// ordinary free list is empty.
+//
+// kalloc_pages() allocates a block of 2^order pages, such as
+// a megapage for kalloc_mega(). Each of its pages has a
+// reference count of 1 while it is allocated, so that a
+// megapage mapping can be split into ordinary page mappings
+// and its pages freed one by one with kfree().
+//
+// Building with KJUNK=1 fills freed and allocated pages with
+// junk, to catch dangling references.
 
 #include "types.h"
 #include "param.h"
@@ -9,7 +42,11 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
+#define KORDER 5             // order of a batch of pages
+#define KBATCH (1 << KORDER) // max pages moved by one refill or steal
+#define KCACHE (2 * KBATCH)  // max pages cached per CPU
+#define ZPOOL  64            // max zeroed pages per CPU
+#define MEGAORDER 9          // order of a megapage
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
@@ -18,48 +55,207 @@ struct run {
   struct run *next;
 };
 
-struct { 
-  struct spinlock lock; // protect free list
+struct kmem {
+  struct spinlock lock; // protect free lists
   struct run *freelist;
-} kmem;
+  int nfree;            // pages on freelist
+  struct run *zerolist; // free pages that are all zero
+  int nzero;            // pages on zerolist
+};
+
+struct kmem kmem[NCPU];
+
+// reference counts of physical pages, indexed by PA2REF().
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int pgref[(PHYSTOP - KERNBASE) / PGSIZE];
 
 void
 kinit() // init allocator
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  buddyinit(end, (void*)PHYSTOP);
 }
 
-void
-freerange(void *pa_start, void *pa_end) // add free memory to free list
+// Take up to n pages from the head of list *l, which holds
+// *nl pages. Returns the first page and sets *last to the
+// last one; returns the number of pages taken in *n.
+static struct run*
+ktake(struct run **l, int *nl, int *n, struct run **last)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  struct run *first;
+  int i;
+
+  first = *last = *l;
+  if(first == 0 || *n <= 0){
+    *n = 0;
+    return 0;
+  }
+  for(i = 1; i < *n && (*last)->next; i++)
+    *last = (*last)->next;
+  *l = (*last)->next;
+  *nl -= i;
+  *n = i;
+  return first;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Move up to KBATCH pages from the CPU with the most free
+// pages onto CPU id's free lists, ordinary pages first.
+// Returns the number of pages moved.
+// Interrupts must be off, and kmem[id].lock not held.
+static int
+ksteal(int id)
+{
+  struct kmem *victim;
+  struct run *first, *last, *zfirst, *zlast;
+  int i, n, nz, best;
+
+  // pick a victim without locking; nfree is only a hint.
+  best = -1;
+  n = 0;
+  for(i = 0; i < NCPU; i++){
+    if(i != id && kmem[i].nfree + kmem[i].nzero > n){
+      n = kmem[i].nfree + kmem[i].nzero;
+      best = i;
+    }
+  }
+  if(best < 0)
+    return 0;
+  victim = &kmem[best];
+
+  // take half of the victim's pages, at most KBATCH.
+  acquire(&victim->lock);
+  n = (victim->nfree + victim->nzero + 1) / 2;
+  if(n > KBATCH)
+    n = KBATCH;
+  nz = n;
+  first = ktake(&victim->freelist, &victim->nfree, &n, &last);
+  nz -= n;
+  zfirst = ktake(&victim->zerolist, &victim->nzero, &nz, &zlast);
+  release(&victim->lock);
+
+  acquire(&kmem[id].lock);
+  if(first){
+    last->next = kmem[id].freelist;
+    kmem[id].freelist = first;
+    kmem[id].nfree += n;
+  }
+  if(zfirst){
+    zlast->next = kmem[id].zerolist;
+    kmem[id].zerolist = zfirst;
+    kmem[id].nzero += nz;
+  }
+  release(&kmem[id].lock);
+
+  return n + nz;
+}
+
+// Move a block of up to KBATCH pages from the buddy allocator
+// onto CPU id's free list. Returns the number of pages moved.
+// Interrupts must be off, and kmem[id].lock not held.
+static int
+krefill(int id)
+{
+  struct run *r;
+  char *b, *p;
+  int order;
+
+  b = 0;
+  for(order = KORDER; order >= 0; order--)
+    if((b = buddyalloc(order)) != 0)
+      break;
+  if(b == 0)
+    return 0;
+
+  acquire(&kmem[id].lock);
+  for(p = b; p < b + (PGSIZE << order); p += PGSIZE){
+    r = (struct run*)p;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = r;
+  }
+  kmem[id].nfree += 1 << order;
+  release(&kmem[id].lock);
+  return 1 << order;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *first, *last;
+  int id, n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if(pgref[PA2REF(pa)] < 1)
+    panic("kfree: ref");
+  if(__sync_sub_and_fetch(&pgref[PA2REF(pa)], 1) > 0)
+    return;
+
+#ifdef KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist; // 头插法
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist; // 头插法
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  first = 0;
+  if(kmem[id].nfree > KCACHE){
+    n = KBATCH;
+    first = ktake(&kmem[id].freelist, &kmem[id].nfree, &n, &last);
+  }
+  release(&kmem[id].lock);
+  pop_off();
+
+  // too many cached pages; give a batch back.
+  while(first){
+    r = first;
+    first = r == last ? 0 : r->next;
+    buddyfree(r, 0);
+  }
+}
+
+// Allocate a page from CPU id's free lists, stealing from
+// other CPUs if they are empty. If zeroed is set, prefer a
+// page from the zeroed pool, and set *zero if the page came
+// from it. Interrupts must be off.
+static struct run*
+kget(int id, int zeroed, int *zero)
+{
+  struct run *r;
+  struct kmem *km = &kmem[id];
+
+  for(;;){
+    acquire(&km->lock);
+    if(zeroed && km->zerolist){
+      r = km->zerolist;
+      km->zerolist = r->next;
+      km->nzero--;
+      *zero = 1;
+    } else if((r = km->freelist) != 0){
+      km->freelist = r->next;
+      km->nfree--;
+      *zero = 0;
+    } else if((r = km->zerolist) != 0){
+      km->zerolist = r->next;
+      km->nzero--;
+      *zero = 1;
+    }
+    release(&km->lock);
+    if(r || (krefill(id) == 0 && ksteal(id) == 0))
+      return r;
+  }
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,25 +265,157 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int zero;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  r = kget(cpuid(), 0, &zero);
+  pop_off();
 
-  if(r)
+  if(r){
+    pgref[PA2REF(r)] = 1;
+#ifdef KJUNK
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
 
-uint64 count_free_memory(void){
-  uint64 count = 0;
+// Allocate one 4096-byte page of zeroed physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
   struct run *r;
-  r = kmem.freelist;
-  while(!r){
-    count++;
-    r = r->next;
+  int zero;
+
+  push_off();
+  r = kget(cpuid(), 1, &zero);
+  pop_off();
+
+  if(r){
+    pgref[PA2REF(r)] = 1;
+    if(zero)
+      r->next = 0;  // the only non-zero word of a pool page
+    else
+      memset((char*)r, 0, PGSIZE);
+  }
+  return (void*)r;
+}
+
+// Allocate 2^order contiguous pages, aligned to their size.
+// Returns 0 if there is no free block that large.
+void *
+kalloc_pages(int order)
+{
+  char *pa;
+
+  if((pa = buddyalloc(order)) == 0)
+    return 0;
+  for(int i = 0; i < (1 << order); i++)
+    pgref[PA2REF(pa) + i] = 1;
+#ifdef KJUNK
+  memset(pa, 5, PGSIZE << order);
+#endif
+  return pa;
+}
+
+// Free 2^order pages returned by kalloc_pages(), none of
+// which may have been shared.
+void
+kfree_pages(void *pa, int order)
+{
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree_pages");
+  for(int i = 0; i < (1 << order); i++){
+    if(pgref[PA2REF(pa) + i] != 1)
+      panic("kfree_pages: ref");
+    pgref[PA2REF(pa) + i] = 0;
+  }
+#ifdef KJUNK
+  memset(pa, 1, PGSIZE << order);
+#endif
+  buddyfree(pa, order);
+}
+
+// Allocate a zeroed, MEGASIZE-aligned megapage for a megapage
+// mapping. Returns 0 if none is free.
+void *
+kalloc_mega(void)
+{
+  char *pa;
+
+  if((pa = kalloc_pages(MEGAORDER)) != 0)
+    memset(pa, 0, MEGASIZE);
+  return pa;
+}
+
+// Free a megapage returned by kalloc_mega() whose mapping
+// was never split.
+void
+kfree_mega(void *pa)
+{
+  kfree_pages(pa, MEGAORDER);
+}
+
+// Called by scheduler() when this CPU is idle: zero one free
+// page and move it to the CPU's zeroed pool, unless the pool
+// is full. Returns 1 if it zeroed a page, 0 if there was
+// nothing to do.
+int
+kzero(void)
+{
+  struct run *r;
+  struct kmem *km;
+  int done = 0;
+
+  push_off();
+  km = &kmem[cpuid()];
+  // unlocked checks, so an idle CPU with a full pool does
+  // not keep taking the lock.
+  if(km->nzero < ZPOOL && km->freelist){
+    // zero the page with the lock held, so that it is never
+    // missing from both lists. the lock is this CPU's own.
+    acquire(&km->lock);
+    if(km->nzero < ZPOOL && (r = km->freelist) != 0){
+      km->freelist = r->next;
+      km->nfree--;
+      memset((char*)r, 0, PGSIZE);
+      r->next = km->zerolist;
+      km->zerolist = r;
+      km->nzero++;
+      done = 1;
+    }
+    release(&km->lock);
   }
+  pop_off();
+  return done;
+}
+
+// Add a reference to an allocated physical page,
+// e.g. when fork() shares it copy-on-write.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  if(__sync_fetch_and_add(&pgref[PA2REF(pa)], 1) < 1)
+    panic("krefinc: free page");
+}
+
+// Return the number of references to physical page pa.
+int
+krefcnt(void *pa)
+{
+  return pgref[PA2REF(pa)];
+}
+
+// free memory in bytes. kalloc() and kfree() keep each CPU's
+// nfree and nzero up to date, so this need not walk the lists.
+uint64 count_free_memory(void){
+  uint64 count = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    count += kmem[i].nfree + kmem[i].nzero;
+  count += buddyfreepages();
   return count * PGSIZE;
 }
@@ -0,0 +1,10 @@
+// Contention statistics for one spinlock, as returned by
+// lockstats().
+#define NLOCKSTAT 20  // most locks one call reports
+
+struct lockstat {
+  char name[16];
+  uint64 n;           // acquires
+  uint64 nts;         // spins waiting to acquire
+  uint64 maxhold;     // longest hold, in r_time() ticks
+};
@@ -16,10 +16,22 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// its start and end. begin_op() reserves MAXOPBLOCKS blocks
+// of log space; a call that may write more, like a large
+// write(), uses begin_opn(n)/end_opn(n) to reserve n blocks.
+// Usually begin_op() just adds the reservation to the
+// total for in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until it is done.
+//
+// end_op() does not commit. Commits are done by a kernel
+// thread, logflusher(), which groups the system calls of
+// up to LOGTICKS clock ticks into one transaction. It commits
+// once a commit has been asked for (log.flushreq) and the
+// last outstanding operation has ended. A commit is asked for
+// when the transaction has been open for LOGTICKS ticks, when
+// the log is close to full, and by log_force(), which waits
+// for everything logged so far to be on disk.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,43 +40,75 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but the blocks of a commit
+// go to the disk together, as one batch.
+//
+// mkfs chooses the number of log blocks and records it in the
+// superblock. A transaction can use all but the header block,
+// up to MAXLOGSIZE, and no more than a third of the buffer
+// cache, since a commit holds two buffers per logged block.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // max blocks in a transaction.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by executing FS sys calls.
   int committing;  // in commit(), please wait.
+  int flushreq;    // commit once outstanding reaches zero.
+  uint opentick;   // ticks when the open transaction logged its first block.
+  uint64 seq;      // number of the open transaction.
+  uint64 done;     // transactions up to this number are on disk.
   int dev;
+  int ready;       // initlog() has finished, so log_tick() may run.
   struct logheader lh;
 };
 struct log log;
 
+#define LOGTICKS 1 // commit transactions at least this often
+
+// buffers held by a commit; only one commit runs at a time.
+static struct buf *cbufs[MAXLOGSIZE];
+
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog < 1 + 2*MAXOPBLOCKS)
+    panic("initlog: log too small");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1;
+  if(log.cap > MAXLOGSIZE)
+    log.cap = MAXLOGSIZE;
+  if(log.cap > NBUF/3)
+    log.cap = NBUF/3;
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  if(kthread(logflusher, "logflusher") < 0)
+    panic("initlog: logflusher");
+  __sync_synchronize();
+  log.ready = 1;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The home blocks are written to disk as one batch.
 static void
 install_trans(int recovering)
 {
@@ -74,11 +118,14 @@ install_trans(int recovering)
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
-    brelse(dbuf);
+    cbufs[tail] = dbuf;
+  }
+  bwritev(cbufs, log.lh.n);  // write dsts to disk
+  for (tail = 0; tail < log.lh.n; tail++) {
+    if(recovering == 0)
+      bunpin(cbufs[tail]);
+    brelse(cbufs[tail]);
   }
 }
 
@@ -126,15 +173,30 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that may write
+// up to n blocks; n must be at most log_maxop().
+void
+begin_opn(int n)
+{
+  if(n > log_maxop())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.flushreq){
+      // let the outstanding ops finish so the commit can start.
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
+      log.flushreq = 1;
+      wakeup(&log.flushreq);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -142,39 +204,110 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
 
+// called at the end of an FS system call that began with
+// begin_opn(n). wakes logflusher() if this was the last
+// outstanding operation and a commit is wanted.
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0 && log.flushreq)
+    wakeup(&log.flushreq);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.reserved has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
+
+// Body of the log flusher kernel thread. Commits the open
+// transaction whenever a commit has been asked for and no
+// FS system calls are executing.
+static void
+logflusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(!log.flushreq || log.outstanding > 0)
+      sleep(&log.flushreq, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
     log.committing = 0;
+    log.flushreq = 0;
+    log.done = log.seq;
+    log.seq += 1;
     wakeup(&log);
-    release(&log.lock);
   }
 }
 
+// Called by clockintr() on every tick. Asks for a commit if
+// the open transaction has been open for LOGTICKS ticks.
+void
+log_tick(void)
+{
+  // clockintr() ticks before the first process has
+  // mounted the file system.
+  if(!log.ready)
+    return;
+  acquire(&log.lock);
+  if(log.lh.n > 0 && !log.committing && !log.flushreq &&
+     ticks - log.opentick >= LOGTICKS){
+    log.flushreq = 1;
+    wakeup(&log.flushreq);
+  }
+  release(&log.lock);
+}
+
+// The most log blocks one FS system call may reserve. Half the
+// log, so that large operations still commit in groups.
+int
+log_maxop(void)
+{
+  return log.cap / 2;
+}
+
+// Wait until every FS system call that has already ended is
+// on disk. Must not be called inside a transaction.
+void
+log_force(void)
+{
+  uint64 target;
+
+  acquire(&log.lock);
+  if(log.committing){
+    // begin_op() holds off new ops during a commit, so
+    // the open transaction is empty.
+    target = log.seq;
+  } else if(log.lh.n > 0){
+    target = log.seq;
+    log.flushreq = 1;
+    wakeup(&log.flushreq);
+  } else {
+    target = log.done;
+  }
+  while(log.done < target)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
 // Copy modified blocks from cache to log.
+// The log blocks are written to disk as one batch.
 static void
 write_log(void)
 {
@@ -184,10 +317,12 @@ write_log(void)
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    cbufs[tail] = to;
   }
+  bwritev(cbufs, log.lh.n);  // write the log
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(cbufs[tail]);
 }
 
 static void
@@ -217,7 +352,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -229,6 +364,8 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    if(log.lh.n == 0)
+      log.opentick = ticks;
     log.lh.n++;
   }
   release(&log.lock);
@@ -28,6 +28,8 @@ main()
     iinit();         // inode table
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+    traceinit();     // system call trace rings
+    profinit();      // profiling sample buffers
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -1,13 +1,13 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NORDER       11  // buddy allocator block sizes, 4KB .. 4MB
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // max # of blocks most FS ops write
+#define LOGSIZE      (MAXOPBLOCKS*10) // default size of on-disk log, for mkfs
+#define MAXLOGSIZE   (BSIZE/4-1)      // max data blocks a log header can name
+#define NBUF         (MAXOPBLOCKS*30) // size of disk block cache
+#define FSSIZE       3000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
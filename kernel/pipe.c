@@ -8,17 +8,19 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
-
+// A pipe is one page: this header, followed by a ring buffer
+// that fills the rest of the page.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  char data[];    // PIPESIZE bytes
 };
 
+#define PIPESIZE (PGSIZE - sizeof(struct pipe))
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -68,15 +70,84 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    freelock(&pi->lock);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Copy up to n bytes from src into the free part of pi's
+// ring, one contiguous run at a time, without sleeping.
+// src is a user address if user_src is set, otherwise a
+// kernel address. Returns the number of bytes copied, or -1
+// if the very first copy faults. Caller holds pi->lock.
+static int
+ringput(struct pipe *pi, int user_src, uint64 src, int n)
+{
+  int i, m, off;
+
+  for(i = 0; i < n; i += m){
+    if(pi->nwrite == pi->nread + PIPESIZE)
+      break;
+    // as much as fits, without wrapping around the ring.
+    off = pi->nwrite % PIPESIZE;
+    m = n - i;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(either_copyin(&pi->data[off], user_src, src + i, m) == -1)
+      return i > 0 ? i : -1;
+    pi->nwrite += m;
+  }
+  return i;
+}
+
+// Copy up to n bytes of pi's unread data, starting skip bytes
+// past the read position, to dst, one contiguous run at a time.
+// dst is a user address if user_dst is set, otherwise a kernel
+// address. Does not consume the data; see ringconsume().
+// Returns the number of bytes copied, or -1 if the very first
+// copy faults. Caller holds pi->lock.
+static int
+ringget(struct pipe *pi, uint skip, int user_dst, uint64 dst, int n)
+{
+  int i, m, off;
+  uint r = pi->nread + skip;
+
+  for(i = 0; i < n; i += m, r += m){
+    if(r == pi->nwrite)
+      break;
+    off = r % PIPESIZE;
+    m = n - i;
+    if(m > pi->nwrite - r)
+      m = pi->nwrite - r;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(either_copyout(user_dst, dst + i, &pi->data[off], m) == -1)
+      return i > 0 ? i : -1;
+  }
+  return i;
+}
+
+// Mark n bytes of pi as read. Caller holds pi->lock.
+static void
+ringconsume(struct pipe *pi, int n)
+{
+  pi->nread += n;
+  // PIPESIZE is not a power of two, so keep the counts from
+  // wrapping around, which would move the ring's origin.
+  if(pi->nread >= PIPESIZE){
+    pi->nread -= PIPESIZE;
+    pi->nwrite -= PIPESIZE;
+  }
+}
+
+// Copy up to n bytes from user address addr into the pipe.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -89,11 +160,9 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      if((m = ringput(pi, 1, addr + i, n - i)) < 0)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -102,12 +171,12 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Copy up to n bytes out of the pipe to user address addr.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +186,152 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
-  }
+  i = ringget(pi, 0, 1, addr, n);  //DOC: piperead-copy
+  if(i < 0)
+    i = 0;
+  ringconsume(pi, i);
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// The functions below let splice() and tee() move data
+// between pipes and the buffer cache, or between two pipes,
+// without a copy through user space. The copies never sleep,
+// so a caller may hold a buffer's lock; a caller waits for
+// data or room first with pipewaitread() or pipewaitwrite().
+
+// Wait until pi has data to read, or has no writer left.
+// Returns the number of bytes available, 0 at end of file,
+// or -1 if the caller has been killed.
+int
+pipewaitread(struct pipe *pi)
+{
+  int n;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->nread == pi->nwrite && pi->writeopen){
+    if(pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  n = pi->nwrite - pi->nread;
+  release(&pi->lock);
+  return n;
+}
+
+// Wait until pi has room to write. Returns the number of
+// bytes of room, or -1 if the read side is closed or the
+// caller has been killed.
+int
+pipewaitwrite(struct pipe *pi)
+{
+  int n;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->readopen && !pr->killed && pi->nwrite == pi->nread + PIPESIZE)
+    sleep(&pi->nwrite, &pi->lock);
+  n = -1;
+  if(pi->readopen && !pr->killed)
+    n = pi->nread + PIPESIZE - pi->nwrite;
+  release(&pi->lock);
+  return n;
+}
+
+// Copy up to n bytes from kernel address src into pi, as
+// many as there is room for. Returns the number copied, or
+// -1 if the read side is closed.
+int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int m;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  m = ringput(pi, 0, (uint64)src, n);
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return m;
+}
+
+// Copy up to n bytes out of pi to kernel address dst, as
+// many as are available. Returns the number copied.
+int
+pipeget(struct pipe *pi, char *dst, int n)
+{
+  int m;
+
+  acquire(&pi->lock);
+  m = ringget(pi, 0, 0, (uint64)dst, n);
+  ringconsume(pi, m);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+  return m;
+}
+
+// Copy up to n bytes from pipe in to pipe out, straight from
+// ring to ring. Waits until in has data and out has room.
+// Consumes the data from in if consume is set (splice), and
+// leaves it for in's reader otherwise (tee). Returns the number
+// of bytes copied, 0 at the end of in, or -1 on error.
+int
+pipesplice(struct pipe *in, struct pipe *out, int n, int consume)
+{
+  struct pipe *first, *second;
+  int m, k, off;
+
+  if(in == out)
+    return -1;
+  if(n == 0)
+    return 0;
+
+  // another reader of in, or writer of out, may get there
+  // between the waits and the copy; wait again if so.
+  for(;;){
+    if((m = pipewaitread(in)) <= 0)
+      return m;
+    if(pipewaitwrite(out) < 0)
+      return -1;
+
+    // lock the two pipes in address order.
+    first = in < out ? in : out;
+    second = in < out ? out : in;
+    acquire(&first->lock);
+    acquire(&second->lock);
+    if(out->readopen == 0){
+      release(&second->lock);
+      release(&first->lock);
+      return -1;
+    }
+    // each run of out's free space is filled from in's ring.
+    for(m = 0; m < n; m += k){
+      if(out->nwrite == out->nread + PIPESIZE)
+        break;
+      off = out->nwrite % PIPESIZE;
+      k = n - m;
+      if(k > out->nread + PIPESIZE - out->nwrite)
+        k = out->nread + PIPESIZE - out->nwrite;
+      if(k > PIPESIZE - off)
+        k = PIPESIZE - off;
+      if((k = ringget(in, m, 0, (uint64)&out->data[off], k)) <= 0)
+        break;
+      out->nwrite += k;
+    }
+    if(consume){
+      ringconsume(in, m);
+      wakeup(&in->nwrite);
+    }
+    wakeup(&out->nread);
+    release(&second->lock);
+    release(&first->lock);
+    if(m > 0)
+      return m;
+  }
+}
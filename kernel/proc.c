@@ -12,10 +12,42 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Number of proc structures not UNUSED, kept up to date by
+// allocproc() and freeproc() so that sysinfo need not scan
+// the proc table.
+static int nproc;
+
+// Per-CPU queues of RUNNABLE processes. A process is on a
+// run queue exactly when it is RUNNABLE; makerunnable() puts
+// it on the queue of the CPU it last ran on, and that CPU's
+// scheduler() takes it off again. A CPU whose queue is empty
+// steals from the CPU with the most queued processes.
+// p->lock must be acquired before a run queue lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;              // number of queued processes
+} runq[NCPU];
+
+// Sleeping processes are kept on sleep queues, hashed by
+// channel, so that wakeup() looks only at processes that
+// may be sleeping on its channel. A queue's lock must be
+// acquired after any lock passed to sleep() and before any
+// p->lock.
+#define NSLEEPQ 61
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 2) % NSLEEPQ])
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -50,6 +82,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -119,6 +155,8 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  memset(p->asid, 0, sizeof(p->asid));
+  __sync_fetch_and_add(&nproc, 1);
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -135,6 +173,14 @@ found:
     return 0;
   }
 
+  // A kernel page table that will mirror the user one.
+  p->kpagetable = kvmcreate();
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -156,6 +202,9 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -163,6 +212,9 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  if(p->state != UNUSED)
+    __sync_fetch_and_sub(&nproc, 1);
   p->state = UNUSED;
 }
 
@@ -242,26 +294,64 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  makerunnable(p);
 
   release(&p->lock);
 }
 
+// Start a kernel thread: a process with no user memory that
+// runs fn() in the kernel. fn must never return.
+// Returns the new thread's pid, or -1 on failure.
+int
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  // start executing at kthreadret instead of forkret.
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  p->cpu = cpuid();
+  makerunnable(p);
+
+  release(&p->lock);
+
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only reserves address space; vmfault() allocates
+// each page when it is first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // user memory must stay below PLIC, where the
+    // kernel page tables' device mappings begin.
+    if(sz + n >= PLIC)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    if(-n > sz)
+      return -1;
+    // uvmdealloc() may have split a megapage even if it
+    // failed, so flush either way.
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    uvmflush(p);
+    if(sz != p->sz + n)
+      return -1;
   }
   p->sz = sz;
   return 0;
@@ -281,8 +371,11 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. This makes the
+  // parent's writable pages copy-on-write.
+  int r = uvmcopy(p->pagetable, np->pagetable, p->sz);
+  uvmflush(p);
+  if(r < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
@@ -312,11 +405,14 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
-  release(&np->lock);
-	
 	// copy mask from parent to child
 	np->mask = p->mask;
+  // a traced parent's children join its trace session;
+  // an untraced parent collects its children's records.
+  np->tracer = p->mask ? p->tracer : p->pid;
+  np->cpu = cpuid();
+  makerunnable(np);
+  release(&np->lock);
 
   return pid;
 }
@@ -430,10 +526,79 @@ wait(uint64 addr)
   }
 }
 
+// Mark p RUNNABLE and add it to the tail of the run queue
+// of CPU p->cpu. Caller must hold p->lock.
+void
+makerunnable(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+
+  if(!holding(&p->lock))
+    panic("makerunnable");
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  acquire(&rq->lock);
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Remove and return the process at the head of rq,
+// or 0 if rq is empty.
+static struct proc*
+rqpop(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    p->rqnext = 0;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Take a process from the busiest other CPU's run queue,
+// or return 0 if every queue is empty. The queue lengths
+// are read without locks, as hints.
+static struct proc*
+steal(int id)
+{
+  struct proc *p;
+  int i, n, busiest, most;
+
+  for(;;){
+    busiest = -1;
+    most = 0;
+    for(i = 0; i < NCPU; i++){
+      n = __atomic_load_n(&runq[i].n, __ATOMIC_RELAXED);
+      if(i != id && n > most){
+        most = n;
+        busiest = i;
+      }
+    }
+    if(busiest < 0)
+      return 0;
+    // another CPU may have emptied the queue since we looked.
+    if((p = rqpop(&runq[busiest])) != 0)
+      return p;
+  }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue, or
+//    steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -442,28 +607,43 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
+  struct runq *rq = &runq[id];
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    p = 0;
+    if(__atomic_load_n(&rq->n, __ATOMIC_RELAXED) > 0)
+      p = rqpop(rq);
+    if(p == 0)
+      p = steal(id);
+    if(p == 0){
+      // nothing to run; zero a free page for kalloc_zeroed().
+      kzero();
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    c->nswitch++;
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -500,7 +680,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  makerunnable(p);
   sched();
   release(&p->lock);
 }
@@ -526,34 +706,63 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold sq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks sq->lock),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&sq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = sq->head;
+  sq->head = p;
+  p->onsleepq = 1;
+  release(&sq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() takes p off the sleep queue, but kill() does not.
+  acquire(&sq->lock);
+  if(p->onsleepq){
+    for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+      ;
+    *pp = p->sqnext;
+    p->onsleepq = 0;
+  }
+  release(&sq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -562,17 +771,27 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&sq->lock);
+  pp = &sq->head;
+  while((p = *pp) != 0){
     if(p != myproc()){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+      if(p->chan == chan) {
+        if(p->state == SLEEPING)
+          makerunnable(p);
+        *pp = p->sqnext;
+        p->onsleepq = 0;
+        release(&p->lock);
+        continue;
       }
       release(&p->lock);
     }
+    pp = &p->sqnext;
   }
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -589,7 +808,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        makerunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -599,6 +818,24 @@ kill(int pid)
   return -1;
 }
 
+// Is any live process still sending its trace records
+// to the process with the given pid?
+int
+tracing(int pid)
+{
+  struct proc *p;
+  int found;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    found = p->tracer == pid && p->state != UNUSED && p->state != ZOMBIE;
+    release(&p->lock);
+    if(found)
+      return 1;
+  }
+  return 0;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -660,13 +897,11 @@ procdump(void)
 
 // count the number of proc's state is not UNUSED 
 uint64 count_proc_not_UNUSED(void){
-  uint64 count = 0;
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state != UNUSED)
-      count++;
-  }
+  return __atomic_load_n(&nproc, __ATOMIC_RELAXED);
+}
 
-  return count;
+// context switches into processes made by CPU id.
+// each CPU updates only its own count.
+uint64 count_context_switches(int id){
+  return __atomic_load_n(&cpus[id].nswitch, __ATOMIC_RELAXED);
 }
@@ -24,6 +24,10 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 nswitch;             // Context switches into processes.
+  uint asidmax;               // Largest ASID this hart supports, or 0.
+  uint asidnext;              // Next ASID to hand out.
+  uint64 asidgen;             // Generation of the ASIDs handed out.
 };
 
 extern struct cpu cpus[NCPU];
@@ -93,6 +97,11 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 	int mask;										 // New syscall
+  int tracer;                  // Pid whose tracedrain() takes p's trace records
+  int cpu;                     // CPU whose run queue p joins when RUNNABLE
+  struct proc *rqnext;         // Next in run queue; with run queue lock
+  struct proc *sqnext;         // Next in sleep queue; with sleep queue lock
+  int onsleepq;                // On a sleep queue? with sleep queue lock
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -101,9 +110,12 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, with the user mappings
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // If non-zero, kernel thread body
+  uint64 asid[NCPU];           // Per-hart ASID, generation << 16 | ASID
 };
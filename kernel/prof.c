@@ -0,0 +1,115 @@
+// Sampling profiler.
+//
+// While profiling is on, each timer interrupt records the
+// interrupted pc, and whether it was in user or kernel mode,
+// in a buffer belonging to the CPU it arrived on. Each CPU
+// has its own buffer, so taking a sample does not contend
+// with other CPUs. profdrain() copies the samples out to a
+// user program. A full buffer drops new samples.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+#define NPROF 512     // samples per CPU
+
+int profiling;
+
+struct {
+  struct spinlock lock;
+  int n;
+  uint64 lost;        // samples dropped because the buffer was full
+  struct profsample s[NPROF];
+} profbuf[NCPU];
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&profbuf[i].lock, "prof");
+}
+
+// Called by devintr() on every timer interrupt, with
+// interrupts off.
+void
+profsample(uint64 pc, int user)
+{
+  struct proc *p;
+  struct profsample *s;
+  int id;
+
+  if(__atomic_load_n(&profiling, __ATOMIC_RELAXED) == 0)
+    return;
+  id = cpuid();
+  p = myproc();
+  acquire(&profbuf[id].lock);
+  if(profbuf[id].n == NPROF){
+    profbuf[id].lost++;
+  } else {
+    s = &profbuf[id].s[profbuf[id].n++];
+    s->pc = pc;
+    s->user = user;
+    s->pid = p ? p->pid : 0;
+    if(p)
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    else
+      s->name[0] = 0;
+  }
+  release(&profbuf[id].lock);
+}
+
+// Turn sampling on or off. Turning it on throws away
+// samples left from before.
+void
+profile(int on)
+{
+  if(on){
+    for(int i = 0; i < NCPU; i++){
+      acquire(&profbuf[i].lock);
+      profbuf[i].n = 0;
+      profbuf[i].lost = 0;
+      release(&profbuf[i].lock);
+    }
+  }
+  __atomic_store_n(&profiling, on != 0, __ATOMIC_RELAXED);
+}
+
+// Copy up to n samples to user address dst, taking them out
+// of the buffers, and add the number of dropped samples to
+// *lost. Returns the number of samples copied, or -1.
+int
+profdrain(uint64 dst, int n, uint64 *lost)
+{
+  struct profsample batch[8];
+  int i, k, m, total;
+
+  total = 0;
+  for(i = 0; i < NCPU; i++){
+    acquire(&profbuf[i].lock);
+    *lost += profbuf[i].lost;
+    profbuf[i].lost = 0;
+    release(&profbuf[i].lock);
+
+    while(total < n){
+      // copyout() may fault, so copy a batch out of the
+      // buffer first and give up the lock.
+      acquire(&profbuf[i].lock);
+      for(m = 0; m < NELEM(batch) && m < n - total && profbuf[i].n > 0; m++)
+        batch[m] = profbuf[i].s[--profbuf[i].n];
+      release(&profbuf[i].lock);
+      if(m == 0)
+        break;
+      k = sizeof(batch[0]) * m;
+      if(copyout(myproc()->pagetable, dst, (char*)batch, k) < 0)
+        return -1;
+      dst += k;
+      total += m;
+    }
+  }
+  return total;
+}
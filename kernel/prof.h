@@ -0,0 +1,7 @@
+// One profiling sample, as returned by profdrain().
+struct profsample {
+  uint64 pc;          // sepc when the timer interrupt arrived
+  int pid;            // current process, or 0
+  int user;           // 1 if pc is a user address
+  char name[16];      // current process's name
+};
@@ -0,0 +1,175 @@
+// Object caches for fixed-size kernel objects.
+//
+// A struct kmem_cache hands out objects of one size, carved
+// out of pages from kalloc(), so that a table of objects can
+// grow with demand instead of being a fixed array. Each page
+// starts with a struct slab that keeps the page's own free
+// objects; pages with any free objects are on the cache's
+// partial list, and a page goes back to kalloc() as soon as
+// all of its objects are free.
+//
+// Each CPU keeps a magazine of up to MAGSIZE free objects,
+// which kmem_cache_alloc() and kmem_cache_free() use with
+// only interrupts turned off. Objects move between a magazine
+// and the pages MAGSIZE/2 at a time, under the cache's lock.
+// So at most MAGSIZE objects per CPU keep pages from being
+// freed.
+//
+// A cache may have a constructor, which prepares each object
+// once when its page is carved up, rather than on every
+// allocation, and a destructor, which undoes it before the
+// page is freed. Objects keep their constructed state while
+// free, except for their first 8 bytes, which link the free
+// objects of a page.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+#define OBJ0(s) ((char*)(s) + sizeof(struct slab))
+
+// Set up cache c for objects of size bytes, which must fit
+// in a page along with its header. ctor and dtor may be 0.
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size,
+                void (*ctor)(void*), void (*dtor)(void*))
+{
+  c->name = name;
+  c->size = (size + 7) & ~7;  // keep objects 8-byte aligned
+  if(c->size < sizeof(void*) || c->size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_init");
+  c->perpage = (PGSIZE - sizeof(struct slab)) / c->size;
+  c->ctor = ctor;
+  c->dtor = dtor;
+  c->partial.next = c->partial.prev = &c->partial;
+  initlock(&c->lock, name);
+}
+
+static void
+slabpush(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Carve a new page into objects, and put it on c's partial
+// list. Caller holds c->lock.
+static int
+grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return -1;
+  s->free = 0;
+  s->nfree = 0;
+  for(p = OBJ0(s); p + c->size <= (char*)s + PGSIZE; p += c->size){
+    if(c->ctor)
+      c->ctor(p);
+    *(void**)p = s->free;
+    s->free = p;
+    s->nfree++;
+  }
+  slabpush(c, s);
+  c->npages++;
+  return 0;
+}
+
+// Take a free object from the first page on c's partial list,
+// which must not be empty. Caller holds c->lock.
+static void*
+slabget(struct kmem_cache *c)
+{
+  struct slab *s = c->partial.next;
+  void *obj;
+
+  obj = s->free;
+  s->free = *(void**)obj;
+  if(--s->nfree == 0)
+    slabunlink(s);
+  return obj;
+}
+
+// Give obj back to its page, and the page back to kalloc()
+// if that leaves all its objects free. Caller holds c->lock.
+static void
+slabput(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  char *p;
+
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(s->nfree++ == 0)
+    slabpush(c, s);
+  if(s->nfree == c->perpage){
+    slabunlink(s);
+    if(c->dtor)
+      for(p = OBJ0(s); p + c->size <= (char*)s + PGSIZE; p += c->size)
+        c->dtor(p);
+    kfree((void*)s);
+    c->npages--;
+  }
+}
+
+// Allocate an object from c. Apart from anything the
+// constructor set up, its contents are garbage.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == 0){
+    // refill the magazine from the pages, growing the cache
+    // only if nothing at all is free.
+    acquire(&c->lock);
+    while(c->mag[id].n < MAGSIZE/2){
+      if(c->partial.next == &c->partial && (c->mag[id].n > 0 || grow(c) < 0))
+        break;
+      c->mag[id].obj[c->mag[id].n++] = slabget(c);
+    }
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  pop_off();
+  return obj;
+}
+
+// Return obj to c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == MAGSIZE){
+    // make room by giving half the magazine back to its pages.
+    acquire(&c->lock);
+    while(c->mag[id].n > MAGSIZE/2)
+      slabput(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  pop_off();
+}
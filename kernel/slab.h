@@ -0,0 +1,28 @@
+// A cache of equal-sized kernel objects; see slab.c.
+#define MAGSIZE 8   // objects per magazine
+
+// The header at the start of each page of a cache.
+struct slab {
+  struct slab *next;      // in the cache's partial list
+  struct slab *prev;
+  void *free;             // this page's free objects
+  int nfree;              // objects on free
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;              // bytes per object
+  uint perpage;           // objects per page
+  void (*ctor)(void*);    // prepares each object of a new page, or 0
+  void (*dtor)(void*);    // undoes ctor before a page is freed, or 0
+  struct spinlock lock;   // protects partial, the slabs on it, npages
+  struct slab partial;    // circular list of pages with free objects
+  int npages;             // pages carved into objects
+
+  // Each CPU's magazine of free objects, used with
+  // interrupts off and without taking lock.
+  struct {
+    int n;
+    void *obj[MAGSIZE];
+  } mag[NCPU];
+};
@@ -7,6 +7,15 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// Every lock passed to initlock() is registered in locks[],
+// so that lockstats() can report on all of them. Locks in
+// memory that is freed must be removed with freelock().
+#define NLOCK 1000
+
+static struct spinlock *locks[NLOCK];
+static struct spinlock lock_locks = { .name = "lock_locks" };
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +23,34 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->maxhold = 0;
+
+  // a full table just leaves the lock out of the report.
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      break;
+    }
+  }
+  release(&lock_locks);
+}
+
+// Remove lk from the table, before the memory holding it
+// is freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -29,8 +66,9 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  uint64 nts = 0;
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    nts++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +78,9 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
+  lk->nts += nts;
+  lk->start = r_time();
 }
 
 // Release the lock.
@@ -49,6 +90,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  uint64 held = r_time() - lk->start;
+  if(held > lk->maxhold)
+    lk->maxhold = held;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -108,3 +152,40 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy statistics for the n most contended locks, those with
+// the most spins, to user address dst, most contended first.
+// Returns the number of locks reported, or -1.
+int
+lockstats(uint64 dst, int n)
+{
+  struct lockstat top[NLOCKSTAT], ls;
+  struct spinlock *lk;
+  int i, j, ntop;
+
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  ntop = 0;
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if((lk = locks[i]) == 0)
+      continue;
+    // the counts are read without lk, so may be a little stale.
+    ls.n = lk->n;
+    ls.nts = lk->nts;
+    ls.maxhold = lk->maxhold;
+    if(ntop == n && (n == 0 || ls.nts <= top[n-1].nts))
+      continue;
+    safestrcpy(ls.name, lk->name, sizeof(ls.name));
+    if(ntop < n)
+      ntop++;
+    for(j = ntop - 1; j > 0 && top[j-1].nts < ls.nts; j--)
+      top[j] = top[j-1];
+    top[j] = ls;
+  }
+  release(&lock_locks);
+
+  if(copyout(myproc()->pagetable, dst, (char*)top, ntop * sizeof(top[0])) < 0)
+    return -1;
+  return ntop;
+}
@@ -5,5 +5,11 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Contention statistics, updated while the lock is held.
+  uint64 n;          // Number of acquires.
+  uint64 nts;        // Spins in acquire() waiting for the lock.
+  uint64 start;      // r_time() when the lock was acquired.
+  uint64 maxhold;    // Longest hold, in r_time() ticks.
 };
 
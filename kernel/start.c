@@ -43,6 +43,12 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor and user mode read the time CSR,
+  // for fine-grained timing, and supervisor mode read
+  // the cycle CSR, for timing system calls.
+  w_mcounteren(r_mcounteren() | COUNTEREN_TM | COUNTEREN_CY);
+  w_scounteren(r_scounteren() | COUNTEREN_TM);
+
   // ask for clock interrupts.
   timerinit();
 
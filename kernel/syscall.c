@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "trace.h"
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -106,6 +107,13 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_tee(void);
+extern uint64 sys_tracedrain(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_profdrain(void);
+extern uint64 sys_lockstats(void);
 
 // function pointer array , syscall no argument return uint64
 static uint64 (*syscalls[])(void) = {
@@ -132,32 +140,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_trace]		sys_trace,
 [SYS_sysinfo] sys_sysinfo,
+[SYS_fsync]   sys_fsync,
+[SYS_splice]  sys_splice,
+[SYS_tee]     sys_tee,
+[SYS_tracedrain] sys_tracedrain,
+[SYS_profile] sys_profile,
+[SYS_profdrain] sys_profdrain,
+[SYS_lockstats] sys_lockstats,
 };
 
-static char *syscall_names[] = {
-  [SYS_fork]    "fork",
-  [SYS_exit]    "exit",
-  [SYS_wait]    "wait",
-  [SYS_pipe]    "pipe",
-  [SYS_read]    "read",
-  [SYS_kill]    "kill",
-  [SYS_exec]    "exec",
-  [SYS_fstat]   "fstat",
-  [SYS_chdir]   "chdir",
-  [SYS_dup]     "dup",
-  [SYS_getpid]  "getpid",
-  [SYS_sbrk]    "sbrk",
-  [SYS_sleep]   "sleep",
-  [SYS_uptime]  "uptime",
-  [SYS_open]    "open",
-  [SYS_write]   "write",
-  [SYS_mknod]   "mknod",
-  [SYS_unlink]  "unlink",
-  [SYS_link]    "link",
-  [SYS_mkdir]   "mkdir",
-  [SYS_close]   "close",
-  [SYS_trace]   "trace",
-};
 
 
 void
@@ -168,13 +159,24 @@ syscall(void)
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    p->trapframe->a0 = syscalls[num]();
-		if(p->mask > 0){ // trace
-			if(p->mask == 2147483647) // trace all syscall 
-				printf("%d: syscall %s -> %d\n", p->pid, syscall_names[num], p->trapframe->a0);
-			else if(1 << num == p->mask) // trace mask syscall
-				printf("%d: syscall %s -> %d\n", p->pid, syscall_names[num], p->trapframe->a0);
-		}		
+    if(((uint)p->mask >> num) & 1){
+      // traced: note the arguments, which the return
+      // value overwrites, and time the call.
+      struct traceent e;
+      e.pid = p->pid;
+      e.num = num;
+      e.arg[0] = p->trapframe->a0;
+      e.arg[1] = p->trapframe->a1;
+      e.arg[2] = p->trapframe->a2;
+      e.time = r_time();
+      uint64 c0 = r_cycle();
+      p->trapframe->a0 = syscalls[num]();
+      e.cycles = r_cycle() - c0;
+      e.ret = p->trapframe->a0;
+      tracerecord(&e, p->tracer);
+    } else {
+      p->trapframe->a0 = syscalls[num]();
+    }
   } 
 	else {
     printf("%d %s: unknown sys call %d\n",
@@ -22,3 +22,10 @@
 #define SYS_close  21
 #define SYS_trace  22
 #define SYS_sysinfo 23
+#define SYS_fsync  24
+#define SYS_splice 25
+#define SYS_tee    26
+#define SYS_tracedrain 27
+#define SYS_profile 28
+#define SYS_profdrain 29
+#define SYS_lockstats 30
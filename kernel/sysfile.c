@@ -104,6 +104,47 @@ sys_close(void)
   return 0;
 }
 
+// splice(fdin, fdout, n): move up to n bytes from fdin to
+// fdout inside the kernel. One must be a pipe.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n, 1);
+}
+
+// tee(fdin, fdout, n): copy up to n bytes from pipe fdin to
+// pipe fdout, leaving them to be read from fdin as well.
+uint64
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n, 0);
+}
+
+// Wait until the file system changes made so far are on
+// disk. xv6 has a single log, so this covers every file,
+// not only fd's.
+uint64
+sys_fsync(void)
+{
+  int fd;
+  struct file *f;
+
+  if(argfd(0, &fd, &f) < 0)
+    return -1;
+  log_force();
+  return 0;
+}
+
 uint64
 sys_fstat(void)
 {
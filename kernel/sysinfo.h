@@ -1,6 +1,16 @@
 #include "types.h"
+#include "param.h"
 
+// Filled in by sysinfo(). Every field is kept as a running
+// count, so the call costs the same however busy the system is.
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
-};
\ No newline at end of file
+  uint64 npagefault; // user page faults since boot
+  uint64 nswitch[NCPU]; // context switches since boot, per CPU
+  uint64 bcachehit;  // buffer cache lookups that found the block
+  uint64 bcachemiss; // buffer cache lookups that recycled a buffer
+  uint64 diskread;   // disk reads since boot
+  uint64 diskwrite;  // disk writes since boot
+  uint64 nfreeblock[NORDER]; // free blocks of 2^i pages, in the buddy allocator
+};
@@ -108,6 +108,67 @@ sys_trace(void)
 	return 0;	
 }
 
+// tracedrain(struct traceent *buf, int n, uint64 *lost)
+uint64
+sys_tracedrain(void)
+{
+  uint64 buf, lostaddr, lost;
+  int n;
+
+  if(argaddr(0, &buf) < 0 || argint(1, &n) < 0 || argaddr(2, &lostaddr) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  lost = 0;
+  n = tracedrain(buf, n, &lost);
+  if(lostaddr && copyout(myproc()->pagetable, lostaddr, (char*)&lost, sizeof(lost)) < 0)
+    return -1;
+  return n;
+}
+
+uint64
+sys_profile(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  profile(on);
+  return 0;
+}
+
+// profdrain(struct profsample *buf, int n, uint64 *lost)
+uint64
+sys_profdrain(void)
+{
+  uint64 buf, lostaddr, lost;
+  int n;
+
+  if(argaddr(0, &buf) < 0 || argint(1, &n) < 0 || argaddr(2, &lostaddr) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  lost = 0;
+  n = profdrain(buf, n, &lost);
+  if(lostaddr && copyout(myproc()->pagetable, lostaddr, (char*)&lost, sizeof(lost)) < 0)
+    return -1;
+  return n;
+}
+
+// lockstats(struct lockstat *buf, int n)
+uint64
+sys_lockstats(void)
+{
+  uint64 buf;
+  int n;
+
+  if(argaddr(0, &buf) < 0 || argint(1, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return lockstats(buf, n);
+}
+
 uint64
 sys_sysinfo(void)
 {
@@ -120,6 +181,14 @@ sys_sysinfo(void)
 
   info.freemem = count_free_memory();
   info.nproc = count_proc_not_UNUSED();
+  info.npagefault = count_page_faults();
+  for(int i = 0; i < NCPU; i++)
+    info.nswitch[i] = count_context_switches(i);
+  info.bcachehit = count_bcache_hits();
+  info.bcachemiss = count_bcache_misses();
+  info.diskread = count_disk_reads();
+  info.diskwrite = count_disk_writes();
+  buddystats(info.nfreeblock);
 
   if(copyout(p->pagetable, addr, (char*)&info, sizeof(info)) < 0)
     return -1;
@@ -0,0 +1,144 @@
+// System call tracing.
+//
+// syscall() records each call a process has asked to trace in
+// a ring belonging to the CPU it finishes on, so tracing costs
+// a few stores rather than console output, and CPUs do not
+// contend with each other. tracedrain() copies the records out
+// to a user program in bulk. A full ring overwrites its oldest
+// record and counts it as lost, rather than wait for a reader,
+// so that the newest records are kept.
+//
+// Each record belongs to the process's tracer, and only the
+// tracer's tracedrain() takes it, so that two trace sessions
+// do not steal each other's records. A child's tracer is its
+// parent, unless the parent is itself traced, in which case
+// the child shares the parent's tracer; see fork().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+
+#define NTRACE 1024   // records per CPU, several ticks' worth
+
+struct {
+  struct spinlock lock;
+  uint head;          // next record to drain
+  uint tail;          // next record to fill
+  struct {
+    int tracer;       // pid that may drain this record
+    struct traceent e;
+  } ent[NTRACE];
+  struct {
+    int tracer;
+    uint64 n;         // tracer's records overwritten before they were drained
+  } lost[NPROC];
+} tracebuf[NCPU];
+
+void
+traceinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&tracebuf[i].lock, "trace");
+}
+
+// Count a record for tracer that a full ring overwrote.
+// Caller holds the ring's lock.
+static void
+tracelost(int id, int tracer)
+{
+  int i, free = -1;
+
+  for(i = 0; i < NPROC; i++){
+    if(tracebuf[id].lost[i].n > 0 && tracebuf[id].lost[i].tracer == tracer){
+      tracebuf[id].lost[i].n++;
+      return;
+    }
+    if(tracebuf[id].lost[i].n == 0 && free < 0)
+      free = i;
+  }
+  if(free >= 0){
+    tracebuf[id].lost[free].tracer = tracer;
+    tracebuf[id].lost[free].n = 1;
+  }
+}
+
+// Add e, which belongs to tracer, to this CPU's ring.
+void
+tracerecord(struct traceent *e, int tracer)
+{
+  push_off();
+  int id = cpuid();
+  acquire(&tracebuf[id].lock);
+  if(tracebuf[id].tail - tracebuf[id].head == NTRACE){
+    tracelost(id, tracebuf[id].ent[tracebuf[id].head % NTRACE].tracer);
+    tracebuf[id].head++;
+  }
+  tracebuf[id].ent[tracebuf[id].tail % NTRACE].tracer = tracer;
+  tracebuf[id].ent[tracebuf[id].tail++ % NTRACE].e = *e;
+  release(&tracebuf[id].lock);
+  pop_off();
+}
+
+// Copy up to n of the calling process's records to user
+// address dst, taking them out of the rings and leaving other
+// tracers' records in order, and add the number of its
+// overwritten records to *lost. Records are in order within a
+// CPU but not between CPUs; callers can sort on time. Returns
+// the number of records copied, or -1 if there are none and no
+// process reports to the caller any more, or on error.
+int
+tracedrain(uint64 dst, int n, uint64 *lost)
+{
+  struct traceent batch[8];
+  int i, k, m, total, me, alive;
+  uint j, w;
+
+  me = myproc()->pid;
+  // check first: a process that has gone has already
+  // recorded everything it will.
+  alive = tracing(me);
+  total = 0;
+  for(i = 0; i < NCPU; i++){
+    acquire(&tracebuf[i].lock);
+    for(k = 0; k < NPROC; k++){
+      if(tracebuf[i].lost[k].n > 0 && tracebuf[i].lost[k].tracer == me){
+        *lost += tracebuf[i].lost[k].n;
+        tracebuf[i].lost[k].n = 0;
+      }
+    }
+    release(&tracebuf[i].lock);
+
+    while(total < n){
+      // copyout() may fault, so take a batch out of the ring
+      // first and give up the lock. the records left behind
+      // move up to close the gaps.
+      acquire(&tracebuf[i].lock);
+      m = 0;
+      w = tracebuf[i].head;
+      for(j = tracebuf[i].head; j != tracebuf[i].tail; j++){
+        if(tracebuf[i].ent[j % NTRACE].tracer == me &&
+           m < NELEM(batch) && m < n - total)
+          batch[m++] = tracebuf[i].ent[j % NTRACE].e;
+        else if(w++ != j)
+          tracebuf[i].ent[(w-1) % NTRACE] = tracebuf[i].ent[j % NTRACE];
+      }
+      tracebuf[i].tail = w;
+      release(&tracebuf[i].lock);
+      if(m == 0)
+        break;
+      k = sizeof(batch[0]) * m;
+      if(copyout(myproc()->pagetable, dst, (char*)batch, k) < 0)
+        return -1;
+      dst += k;
+      total += m;
+    }
+  }
+  if(total == 0 && !alive)
+    return -1;
+  return total;
+}
@@ -0,0 +1,9 @@
+// One traced system call, as returned by tracedrain().
+struct traceent {
+  int pid;
+  int num;            // system call number
+  uint64 arg[3];      // first three arguments
+  uint64 ret;         // return value
+  uint64 time;        // r_time() when the call started
+  uint64 cycles;      // cycles the call took
+};
@@ -10,6 +10,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopystart[], ucopyfault[], ucopyend[];
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -67,6 +68,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause() == 15) == 0){
+    // page fault on a lazily allocated or copy-on-write page,
+    // which is now mapped; retry the instruction.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -118,8 +123,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and the ASID that tags its TLB entries.
+  uint64 satp = uvmsatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -143,15 +149,25 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) && r_stval() < PLIC &&
+     sepc >= (uint64)ucopystart && sepc < (uint64)ucopyend){
+    // page fault on user memory in ucopy() or ucopystr().
+    // map the page and retry, or make the copy fail.
+    struct proc *p = myproc();
+    if(uvmfault(p, r_stval(), scause == 15) < 0)
+      sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt. don't let
+  // an interrupted ucopy()'s SUM leak to other processes.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
     yield();
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -166,6 +182,7 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  log_tick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -204,6 +221,9 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
+    // sepc and sstatus still describe the interrupted code.
+    profsample(r_sepc(), (r_sstatus() & SSTATUS_SPP) == 0);
+
     if(cpuid() == 0){
       clockintr();
     }
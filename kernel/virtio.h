@@ -44,8 +44,10 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two. the descriptors and the avail ring
+// must fit in the first page of disk.pages[], and the used
+// ring in the second. each request takes three descriptors.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
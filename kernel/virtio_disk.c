@@ -70,6 +70,10 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  // operations submitted since boot; under vdisk_lock.
+  uint64 nread;
+  uint64 nwrite;
   
 } __attribute__ ((aligned (PGSIZE))) disk;
 
@@ -200,12 +204,21 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// tell the device to look at the avail ring.
+// caller holds disk.vdisk_lock.
+static void
+notify(void)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  __sync_synchronize();
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  acquire(&disk.vdisk_lock);
+// add an operation on b to the avail ring. the device may not
+// start it until the next notify(). caller holds disk.vdisk_lock.
+static void
+submit(struct buf *b, int write)
+{
+  uint64 sector = b->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -217,6 +230,9 @@ virtio_disk_rw(struct buf *b, int write)
     if(alloc3_desc(idx) == 0) {
       break;
     }
+    // the descriptors we are waiting for may belong to
+    // operations the device has not been told about yet.
+    notify();
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
@@ -252,6 +268,11 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk.desc[idx[2]].next = 0;
 
+  if(write)
+    disk.nwrite++;
+  else
+    disk.nread++;
+
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
   disk.info[idx[0]].b = b;
@@ -263,19 +284,54 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
-  __sync_synchronize();
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// read or write the n bufs in bs[], and wait for all of them.
+// the device is notified once for the whole batch, so it can
+// work on all of the operations at the same time.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i++)
+    submit(bs[i], write);
+  notify();
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1) {
+      sleep(bs[i], &disk.vdisk_lock);
+    }
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// start reading or writing the n bufs in bs[] and return
+// without waiting. each buf's async flag must be set;
+// virtio_disk_intr() calls bdone() for each one when its
+// operation finishes.
+void
+virtio_disk_start(struct buf **bs, int n, int write)
+{
+  int i;
 
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i++){
+    if(!bs[i]->async)
+      panic("virtio_disk_start");
+    submit(bs[i], write);
+  }
+  notify();
   release(&disk.vdisk_lock);
 }
 
@@ -305,11 +361,30 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
+
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(b->async)
+      bdone(b);
+    else
+      wakeup(b);
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
 }
+
+// disk reads and writes since boot.
+uint64
+count_disk_reads(void)
+{
+  return __atomic_load_n(&disk.nread, __ATOMIC_RELAXED);
+}
+
+uint64
+count_disk_writes(void)
+{
+  return __atomic_load_n(&disk.nwrite, __ATOMIC_RELAXED);
+}
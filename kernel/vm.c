@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +17,18 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+uint64 npagefault; // user page faults handled by vmfault()
+
+static pte_t *walklevel(pagetable_t, uint64, int, int*);
+static uint64 asid(struct proc*);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -37,6 +43,7 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages above the first 2MB boundary.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -57,14 +64,181 @@ kvminit(void)
 }
 
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging. The kernel uses ASID 0. Find out how many
+// ASIDs this hart has for user page tables: satp's ASID field
+// keeps only the bits that are implemented.
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  struct cpu *c = mycpu();
+
+  w_satp(MAKE_SATP(kernel_pagetable, SATP_ASIDMASK));
+  c->asidmax = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+  c->asidnext = 1;
+  c->asidgen = 1;
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
+// Per-process kernel page tables.
+//
+// Each process has its own kernel page table, which the hart
+// uses whenever it runs that process in the kernel. It is the
+// global kernel page table, except that below PLIC it maps the
+// process's user memory, at the same virtual addresses as the
+// user page table. So copyin() and copyout() can use user
+// addresses directly, instead of walking the user page table.
+// User memory must stay below PLIC for this to work.
+//
+// A process's kernel page table has its own level-2 page and
+// its own level-1 page for the lowest 1GB, where PLIC and the
+// devices are. The level-1 PTEs below PLIC are copies of the
+// user page table's, which point at the same level-0 pages or
+// megapages, so most changes to the user page table show up
+// in the kernel page table at once. kvmsync() copies them
+// again when a level-1 PTE may have changed.
+
+// Make a kernel page table for a new process, with no user
+// mappings yet. Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpgtbl, l1, kl1;
+  int i;
+
+  if((kpgtbl = (pagetable_t) kalloc_zeroed()) == 0)
+    return 0;
+  if((l1 = (pagetable_t) kalloc_zeroed()) == 0){
+    kfree(kpgtbl);
+    return 0;
+  }
+  kl1 = (pagetable_t) PTE2PA(kernel_pagetable[0]);
+  for(i = PX(1, PLIC); i < 512; i++)
+    l1[i] = kl1[i];
+  kpgtbl[0] = PA2PTE(l1) | PTE_V;
+  for(i = 1; i < 512; i++)
+    kpgtbl[i] = kernel_pagetable[i];
+  return kpgtbl;
+}
+
+// Free a process's kernel page table. The pages it shares
+// with the global kernel page table and the user page table
+// belong to them.
+void
+kvmfree(pagetable_t kpgtbl)
+{
+  kfree((void*) PTE2PA(kpgtbl[0]));
+  kfree((void*) kpgtbl);
+}
+
+// Copy p's user level-1 PTEs below PLIC into its kernel page
+// table.
+static void
+kvmsync(struct proc *p)
+{
+  pagetable_t kl1, ul1 = 0;
+
+  if(p->kpagetable == 0)
+    return;
+  kl1 = (pagetable_t) PTE2PA(p->kpagetable[0]);
+  if(p->pagetable && (p->pagetable[0] & PTE_V))
+    ul1 = (pagetable_t) PTE2PA(p->pagetable[0]);
+  for(int i = 0; i < PX(1, PLIC); i++)
+    kl1[i] = ul1 ? ul1[i] : 0;
+}
+
+// Switch this hart to p's kernel page table, or back to the
+// global one if p is 0. Called by the scheduler, with
+// interrupts off, around running p.
+void
+kvmswitch(struct proc *p)
+{
+  if(p){
+    kvmsync(p);
+    w_satp(MAKE_SATP(p->kpagetable, asid(p)));
+  } else {
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+  }
+  if(mycpu()->asidmax == 0)
+    sfence_vma();
+}
+
+// User page tables and ASIDs.
+//
+// Each hart hands out its own ASIDs to the processes that
+// run on it, so that their TLB entries survive the switches
+// between user and kernel page tables, and between processes.
+// A process's user and kernel page tables share its ASID:
+// they map the same user memory, and the kernel's mappings
+// lack PTE_U, so user code cannot use them. The exception is
+// TRAPFRAME, which the kernel page tables leave unmapped, just
+// above KSTACK(0); trampoline.S flushes that one address on
+// every trap from user space, so that no user entry for it is
+// ever cached while the kernel runs.
+// p->asid[i] records p's ASID on hart i, along with the hart's
+// generation when it was handed out. When a hart runs out of
+// ASIDs it starts a new generation, which invalidates all of
+// its old ASIDs, and flushes its whole TLB once. A hart with
+// no ASIDs uses ASID 0, and flushes the TLB on every switch,
+// as before.
+
+// Return p's ASID on this hart, giving it one if it has none.
+// Interrupts must be off.
+static uint64
+asid(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(c->asidmax == 0)
+    return 0;
+  if((p->asid[id] >> 16) != c->asidgen){
+    if(c->asidnext > c->asidmax){
+      c->asidgen++;
+      c->asidnext = 1;
+      sfence_vma();
+    }
+    p->asid[id] = (c->asidgen << 16) | c->asidnext++;
+  }
+  return p->asid[id] & SATP_ASIDMASK;
+}
+
+// Return the satp value for running p in user space on this
+// hart. Interrupts must be off.
+uint64
+uvmsatp(struct proc *p)
+{
+  return MAKE_SATP(p->pagetable, asid(p));
+}
+
+// Called after changing p's user page table, on the hart that
+// is running p, or while p cannot run. Brings p's kernel page
+// table's copy of the user mappings up to date, flushes p's TLB
+// entries on this hart, and makes other harts give p a new
+// ASID, with no stale entries, when it next runs there.
+void
+uvmflush(struct proc *p)
+{
+  struct cpu *c;
+  int id;
+
+  kvmsync(p);
+  push_off();
+  c = mycpu();
+  id = cpuid();
+  for(int i = 0; i < NCPU; i++)
+    if(i != id)
+      p->asid[i] = 0;
+  // a hart with no ASIDs must flush everything: a fault in
+  // ucopy() goes back to the copy without passing through
+  // trampoline.S, which would otherwise flush.
+  if(c->asidmax == 0)
+    sfence_vma();
+  else if((p->asid[id] >> 16) == c->asidgen)
+    sfence_vma_asid(p->asid[id] & SATP_ASIDMASK);
+  pop_off();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -77,24 +251,59 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a megapage, the level-1 PTE that maps the
+// whole megapage is returned.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// Like walk(), but return the PTE for va at *level, 0 or 1,
+// or a leaf PTE found above *level. Sets *level to the level
+// of the returned PTE.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
+}
+
+// Replace the megapage leaf PTE *pte with a level-0 page
+// table that maps the same memory, with the same flags, a
+// page at a time. Returns 0, or -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pagetable;
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  if((pagetable = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
 }
 
 // Look up a virtual address, return the physical address,
@@ -105,11 +314,13 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  level = 0;
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -117,6 +328,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level > 0)
+    pa += PGROUNDDOWN(va) % MEGASIZE;  // the page within the megapage
   return pa;
 }
 
@@ -132,13 +345,17 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both MEGASIZE-aligned
+// and at least MEGASIZE bytes remain, a single megapage PTE
+// maps them, unless the range already has a level-0 page
+// table there. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  int level;
 
   if(size == 0)
     panic("mappages: size");
@@ -146,6 +363,22 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % MEGASIZE == 0 && pa % MEGASIZE == 0 && last - a >= MEGASIZE - PGSIZE){
+      level = 1;
+      if((pte = walklevel(pagetable, a, 1, &level)) == 0)
+        return -1;
+      if(*pte & PTE_V){
+        if(PTE_LEAF(*pte))
+          panic("mappages: remap");
+      } else {
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(last - a == MEGASIZE - PGSIZE)
+          break;
+        a += MEGASIZE;
+        pa += MEGASIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -159,31 +392,65 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Split the megapage, if any, that maps the page at va but
+// starts below it, so that the pages below va and from va on
+// can be unmapped separately. Returns 0, or -1 if out of memory.
+static int
+splitat(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level = 0;
+
+  if(va % MEGASIZE == 0 || va >= MAXVA)
+    return 0;
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || (*pte & PTE_V) == 0 || level == 0)
+    return 0;
+  return demote(pte);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched (see vmfault())
+// have no mapping and are skipped. A megapage that is only
+// partly in the range is first split into pages; if there is
+// no memory for that, nothing is unmapped and -1 is returned.
 // Optionally free the physical memory.
-void
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+  if(splitat(pagetable, va) < 0 || splitat(pagetable, end) < 0)
+    return -1;
+  for(a = va; a < end; a += PGSIZE){
+    level = 0;
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0)
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(level > 0){
+      // splitat() left only megapages wholly in the range.
+      if(do_free)
+        kfree_mega((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += MEGASIZE - PGSIZE;
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
     *pte = 0;
   }
+  return 0;
 }
 
 // create an empty user page table.
@@ -192,10 +459,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -209,8 +475,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -228,12 +493,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -246,7 +510,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if a
+// megapage that newsz cuts into could not be split.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -255,7 +520,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) < 0)
+      return oldsz;
   }
 
   return newsz;
@@ -286,15 +552,17 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  // megapages lie wholly below sz, so nothing needs splitting.
+  if(sz > 0 && uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1) < 0)
+    panic("uvmfree");
   freewalk(pagetable);
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: writable pages are shared
+// read-only by parent and child and marked PTE_COW, and
+// uvmcow() copies them on the first write.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -303,22 +571,28 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
+  int level;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    level = 0;
+    if((pte = walklevel(old, i, 0, &level)) == 0)
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(level > 0){
+      // megapages are never shared; split it, so that its
+      // pages can be shared one at a time.
+      if(demote(pte) < 0)
+        goto err;
+      pte = walk(old, i, 0);
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    krefinc((void*)pa);
   }
   return 0;
 
@@ -327,8 +601,169 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the page containing va a private, writable copy
+// if it is shared copy-on-write. If this is the last
+// reference to the page, just make it writable again.
+// Returns 0 on success, -1 if va is not a COW page
+// or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault at user address va in a process whose
+// memory is sz bytes: map a zeroed page if va lies in a part
+// of the heap that sbrk() grew but nobody has touched yet, or
+// break copy-on-write sharing if this is a write. If the whole
+// MEGASIZE-aligned region around va is untouched heap, map a
+// megapage there instead, if one is free.
+// Returns 0 if the access can be retried, -1 if it is bad.
+int
+vmfault(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  char *mem;
+  uint64 a;
+  int level;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW)){
+      if(uvmcow(pagetable, va) < 0)
+        return -1;
+    } else if((*pte & PTE_U) == 0 || (*pte & (write ? PTE_W : PTE_R)) == 0){
+      return -1;
+    }
+    // a copy-on-write break, or another hart mapped the page
+    // after this one cached it as invalid; see uvmfault().
+    __sync_fetch_and_add(&npagefault, 1);
+    return 0;
+  }
+
+  a = va - va % MEGASIZE;
+  if(a + MEGASIZE <= sz){
+    level = 1;
+    pte = walklevel(pagetable, a, 0, &level);
+    if((pte == 0 || (*pte & PTE_V) == 0) && (mem = kalloc_mega()) != 0){
+      if(mappages(pagetable, a, MEGASIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+        kfree_mega(mem);
+        return -1;
+      }
+      __sync_fetch_and_add(&npagefault, 1);
+      return 0;
+    }
+  }
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  __sync_fetch_and_add(&npagefault, 1);
+  return 0;
+}
+
+// Handle a page fault at va in p's user memory, on the hart
+// that is running p, and flush only what the fault changed.
+// A page that was not mapped before needs no flush on other
+// harts: at worst a stale entry there faults again, and
+// vmfault() finds the access already allowed. A copy-on-write
+// break moves the page, so other harts must forget it, as
+// uvmflush() arranges. Returns 0 on success, -1 on error.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte = 0;
+  struct cpu *c;
+  int id;
+
+  va = PGROUNDDOWN(va);
+  if(va < MAXVA)
+    pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V) && write && (*pte & PTE_COW)){
+    if(vmfault(p->pagetable, va, p->sz, write) < 0)
+      return -1;
+    uvmflush(p);
+    return 0;
+  }
+  if(vmfault(p->pagetable, va, p->sz, write) < 0)
+    return -1;
+
+  kvmsync(p);
+  push_off();
+  c = mycpu();
+  id = cpuid();
+  if(pte == 0){
+    // vmfault() added a page-table page or a megapage, which
+    // a flush of one address need not cover.
+    if(c->asidmax == 0)
+      sfence_vma();
+    else if((p->asid[id] >> 16) == c->asidgen)
+      sfence_vma_asid(p->asid[id] & SATP_ASIDMASK);
+  } else if(c->asidmax == 0 || (p->asid[id] >> 16) == c->asidgen){
+    sfence_vma_page(va, p->asid[id] & SATP_ASIDMASK);
+  }
+  pop_off();
+  return 0;
+}
+
+// number of user page faults handled since boot.
+uint64
+count_page_faults(void)
+{
+  return npagefault;
+}
+
+// Make sure the user page at va0 is present, and writable if
+// write is set, faulting it in if necessary. Used by the copy
+// functions below. Returns 0 on success, -1 on error.
+static int
+uvmtouch(pagetable_t pagetable, uint64 va0, int write)
+{
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va0, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))){
+    if(uvmfault(myproc(), va0, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// the kernel sees user memory through its own page table,
+// so make the page unreadable and unwritable by the kernel
+// too, leaving PTE_X so that it is still a leaf.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -337,19 +772,39 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+}
+
+// Is [va, va+len) in the current process's memory?
+static int
+uvmrange(uint64 va, uint64 len)
+{
+  uint64 sz = myproc()->sz;
+
+  return va + len >= va && va + len <= sz;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// The current process's memory is copied directly, through its
+// kernel page table; other page tables, such as the one exec()
+// is building, are walked a page at a time.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(pagetable == myproc()->pagetable){
+    if(!uvmrange(dstva, len))
+      return -1;
+    return ucopy((void *)dstva, src, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
+    if(uvmtouch(pagetable, va0, 1) < 0)
+      return -1;
     pa0 = walkaddr(pagetable, va0); // get dstva's physical adress
     if(pa0 == 0)
       return -1;
@@ -367,14 +822,23 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
+// Like copyout(), copies the current process's memory directly.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(pagetable == myproc()->pagetable){
+    if(!uvmrange(srcva, len))
+      return -1;
+    return ucopy(dst, (void *)srcva, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
+    if(uvmtouch(pagetable, va0, 0) < 0)
+      return -1;
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
@@ -393,6 +857,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
+// Like copyout(), copies the current process's memory directly.
 // Return 0 on success, -1 on error.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
@@ -400,8 +865,18 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(pagetable == myproc()->pagetable){
+    if(srcva >= myproc()->sz)
+      return -1;
+    if(max > myproc()->sz - srcva)
+      max = myproc()->sz - srcva;
+    return ucopystr(dst, (char *)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
+    if(uvmtouch(pagetable, va0, 0) < 0)
+      return -1;
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
@@ -77,8 +77,14 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || nlog < 1 + 2*MAXOPBLOCKS || nlog > 1 + MAXLOGSIZE){
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
+    fprintf(stderr, "nlog must be between %d and %d\n", 1 + 2*MAXOPBLOCKS, 1 + MAXLOGSIZE);
     exit(1);
   }
 
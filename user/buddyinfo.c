@@ -0,0 +1,30 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/sysinfo.h"
+
+// Print the free blocks of each size in the kernel's buddy
+// allocator. Free memory that is mostly in small blocks is
+// fragmented: large contiguous allocations, such as
+// megapages, will fail even though memory is free.
+
+int
+main(int argc, char *argv[])
+{
+  struct sysinfo info;
+  uint64 pages;
+  int i;
+
+  if(sysinfo(&info) < 0){
+    fprintf(2, "buddyinfo: sysinfo failed\n");
+    exit(1);
+  }
+  pages = 0;
+  printf("order\tKB\tblocks\n");
+  for(i = 0; i < NORDER; i++){
+    printf("%d\t%d\t%l\n", i, 4 << i, info.nfreeblock[i]);
+    pages += info.nfreeblock[i] << i;
+  }
+  printf("%l of %l free KB in blocks\n", pages * 4, info.freemem / 1024);
+  exit(0);
+}
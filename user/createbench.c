@@ -0,0 +1,74 @@
+// File creation benchmark for the log's group commit.
+// Creates many small files, writing a few bytes to each,
+// then deletes them, and reports the elapsed ticks for each
+// phase. fsync() makes sure the work is on disk before the
+// clock stops.
+//
+// usage: createbench [nfiles]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char name[16];
+
+void
+mkname(int i)
+{
+  name[0] = 'c';
+  name[1] = 'b';
+  name[2] = '0' + (i / 100) % 10;
+  name[3] = '0' + (i / 10) % 10;
+  name[4] = '0' + i % 10;
+  name[5] = '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n;
+  uint t0, t1, t2;
+
+  n = 100;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 150){
+    fprintf(2, "usage: createbench [nfiles]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(i);
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("createbench: cannot create %s\n", name);
+      exit(1);
+    }
+    if(write(fd, name, 8) != 8){
+      printf("createbench: write %s failed\n", name);
+      exit(1);
+    }
+    if(i == n - 1)
+      fsync(fd);
+    close(fd);
+  }
+  t1 = uptime();
+
+  for(i = 0; i < n; i++){
+    mkname(i);
+    if(unlink(name) < 0){
+      printf("createbench: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+  fd = open(".", O_RDONLY);
+  fsync(fd);
+  close(fd);
+  t2 = uptime();
+
+  printf("createbench: %d files: create %d ticks, unlink %d ticks\n",
+         n, t1 - t0, t2 - t1);
+  exit(0);
+}
@@ -0,0 +1,76 @@
+// Contention benchmark for the physical page allocator.
+// Forks NCPU children that each repeatedly grow and shrink
+// their address space, so that every CPU is in kalloc() and
+// kfree() at the same time, and reports the elapsed ticks.
+//
+// usage: kallocbench [nproc]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES 64   // pages allocated per round
+#define ROUNDS 200
+
+void
+allocator(void)
+{
+  char *a;
+  int i, j;
+
+  for(i = 0; i < ROUNDS; i++){
+    a = sbrk(NPAGES*PGSIZE);
+    if(a == (char*)-1){
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    // touch every page, in case sbrk() allocates lazily.
+    for(j = 0; j < NPAGES; j++)
+      a[j*PGSIZE] = j;
+    if(sbrk(-NPAGES*PGSIZE) == (char*)-1){
+      printf("kallocbench: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid, xstatus, failed;
+  uint t0, t1;
+
+  n = NCPU;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: kallocbench [nproc]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kallocbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      allocator();
+  }
+
+  failed = 0;
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  t1 = uptime();
+
+  printf("kallocbench: %d allocators x %d rounds x %d pages: %d ticks\n",
+         n, ROUNDS, NPAGES, t1 - t0);
+  exit(failed);
+}
@@ -0,0 +1,41 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/lockstat.h"
+
+// lockstat [command [args ...]]
+//
+// Print the most contended spinlocks: for each, the number of
+// acquires, the spins spent waiting for it, and the longest
+// time it was held, in timer ticks. With a command, run it
+// first. The counts are since boot.
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat ls[NLOCKSTAT];
+  int n, i, pid;
+
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  if((n = lockstats(ls, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: lockstats failed\n");
+    exit(1);
+  }
+  printf("lock\tacquires\tspins\tmaxhold\n");
+  for(i = 0; i < n; i++)
+    printf("%s\t%l\t%l\t%l\n", ls[i].name, ls[i].n, ls[i].nts, ls[i].maxhold);
+  exit(0);
+}
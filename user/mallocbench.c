@@ -0,0 +1,85 @@
+// Benchmark for the user memory allocator. Runs a workload of
+// random-sized malloc() and free() calls against a fixed number
+// of live slots, and reports the elapsed ticks and how much
+// heap the allocator used to hold the peak live data.
+//
+// usage: mallocbench [ops]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NSLOT 512
+
+char *slot[NSLOT];
+uint slotsize[NSLOT];
+
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// mostly small objects, some medium, a few large.
+uint
+rndsize(void)
+{
+  uint r = rnd() % 100;
+
+  if(r < 80)
+    return 1 + rnd() % 128;
+  if(r < 97)
+    return 129 + rnd() % 1024;
+  return 1024 + rnd() % 16384;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, ops, n;
+  uint live, peak, t0, t1;
+  char *heap0;
+
+  ops = 200000;
+  if(argc > 1)
+    ops = atoi(argv[1]);
+  if(ops < 1){
+    fprintf(2, "usage: mallocbench [ops]\n");
+    exit(1);
+  }
+
+  heap0 = sbrk(0);
+  live = peak = 0;
+  t0 = uptime();
+  for(n = 0; n < ops; n++){
+    i = rnd() % NSLOT;
+    if(slot[i]){
+      if(slot[i][0] != (char)i || slot[i][slotsize[i]-1] != (char)i){
+        printf("mallocbench: slot %d corrupted\n", i);
+        exit(1);
+      }
+      free(slot[i]);
+      live -= slotsize[i];
+      slot[i] = 0;
+    } else {
+      slotsize[i] = rndsize();
+      if((slot[i] = malloc(slotsize[i])) == 0){
+        printf("mallocbench: malloc(%d) failed\n", slotsize[i]);
+        exit(1);
+      }
+      slot[i][0] = slot[i][slotsize[i]-1] = i;
+      live += slotsize[i];
+      if(live > peak)
+        peak = live;
+    }
+  }
+  t1 = uptime();
+
+  printf("mallocbench: %d ops in %d ticks\n", ops, t1 - t0);
+  printf("mallocbench: peak live %d bytes, heap %d bytes\n",
+         peak, (int)(sbrk(0) - heap0));
+  exit(0);
+}
@@ -0,0 +1,77 @@
+// Pipe throughput benchmark. A child writes a stream of bytes
+// into a pipe in large chunks and the parent reads them out,
+// checking the pattern, and reports the elapsed ticks.
+//
+// usage: pipebench [kbytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define CHUNK 4096
+
+char buf[CHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], i, n, pid, xstatus;
+  uint kb, tot, want;
+  uint t0, t1;
+
+  kb = 4096;
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < 1){
+    fprintf(2, "usage: pipebench [kbytes]\n");
+    exit(1);
+  }
+  want = kb * 1024;
+
+  if(pipe(fds) < 0){
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(tot = 0; tot < want; tot += n){
+      n = want - tot < CHUNK ? want - tot : CHUNK;
+      for(i = 0; i < n; i++)
+        buf[i] = tot + i;
+      if(write(fds[1], buf, n) != n){
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, CHUNK)) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != (char)(tot + i)){
+        printf("pipebench: wrong byte at %d\n", tot + i);
+        exit(1);
+      }
+    }
+    tot += n;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  t1 = uptime();
+
+  if(tot != want || xstatus != 0){
+    printf("pipebench: got %d bytes, expected %d\n", tot, want);
+    exit(1);
+  }
+  printf("pipebench: %d KB in %d ticks\n", kb, t1 - t0);
+  exit(0);
+}
@@ -1,15 +1,79 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 #include <stdarg.h>
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output is buffered per file descriptor. Output to the console
+// and to fd 2 is written at the end of every printf() call, so
+// it appears as promptly as it would unbuffered; output to files
+// and pipes is written when a buffer fills, and by fflush(),
+// close(), fork(), exec() and exit() (see ulib.c).
+#define OUTBUF 512
+
+enum { OUT_NEW, OUT_CALL, OUT_FULL };
+
+static struct {
+  char buf[OUTBUF];
+  int n;
+  int mode;   // how fd is buffered; OUT_NEW until first use
+} out[NOFILE];
+
+extern void (*flushhook)(int);
+
+static void
+flushfd(int fd)
+{
+  if(out[fd].n > 0)
+    write(fd, out[fd].buf, out[fd].n);
+  out[fd].n = 0;
+}
+
+// Write out fd's buffered output, or every fd's if fd is -1.
+void
+fflush(int fd)
+{
+  if(fd == -1){
+    for(fd = 0; fd < NOFILE; fd++)
+      flushfd(fd);
+  } else if(fd >= 0 && fd < NOFILE){
+    flushfd(fd);
+  }
+}
+
+// The flushhook: close() passes the fd it is about to close,
+// and fork(), exec() and exit() pass -1. The next output to a
+// closed fd looks afresh at what kind of file it is.
+static void
+flushclose(int fd)
+{
+  fflush(fd);
+  if(fd >= 0 && fd < NOFILE)
+    out[fd].mode = OUT_NEW;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  if(out[fd].mode == OUT_NEW){
+    if(fd == 2 || fstat(fd, &st) < 0 || st.type == T_DEVICE)
+      out[fd].mode = OUT_CALL;
+    else
+      out[fd].mode = OUT_FULL;
+    flushhook = flushclose;
+  }
+  out[fd].buf[out[fd].n++] = c;
+  if(out[fd].n == OUTBUF)
+    flushfd(fd);
 }
 
 static void
@@ -92,6 +156,8 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOFILE && out[fd].mode == OUT_CALL)
+    flushfd(fd);
 }
 
 void
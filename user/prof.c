@@ -0,0 +1,113 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/prof.h"
+
+// prof command [args ...]
+//
+// Run command with the timer-driven profiler on, then print a
+// histogram of the sampled pcs, most frequent first, one line
+// per pc: the number of samples, "kernel" or the name of the
+// user program, and the pc. Look kernel pcs up in
+// kernel/kernel.sym and user pcs in user/name.sym; the
+// function is the symbol with the largest address not above
+// the pc.
+
+#define BATCH 64
+
+struct bucket {
+  int user;
+  char *name;
+  uint64 pc;
+  int count;
+};
+
+// order samples by where they were taken.
+static int
+before(struct profsample *a, struct profsample *b)
+{
+  int c;
+
+  if(a->user != b->user)
+    return a->user < b->user;
+  if(a->user && (c = strcmp(a->name, b->name)) != 0)
+    return c < 0;
+  return a->pc < b->pc;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct profsample *s, *ns, t;
+  struct bucket *b, u;
+  uint64 lost;
+  int pid, n, max, nb, i, j;
+
+  if(argc < 2){
+    fprintf(2, "Usage: prof command [args ...]\n");
+    exit(1);
+  }
+
+  profile(1);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  profile(0);
+
+  n = 0;
+  max = BATCH;
+  lost = 0;
+  s = malloc(max * sizeof(*s));
+  for(;;){
+    if(n + BATCH > max){
+      ns = malloc(2 * max * sizeof(*s));
+      memmove(ns, s, n * sizeof(*s));
+      free(s);
+      s = ns;
+      max *= 2;
+    }
+    if((i = profdrain(s + n, BATCH, &lost)) <= 0)
+      break;
+    n += i;
+  }
+
+  // count equal samples, then sort the counts.
+  for(i = 1; i < n; i++){
+    t = s[i];
+    for(j = i; j > 0 && before(&t, &s[j-1]); j--)
+      s[j] = s[j-1];
+    s[j] = t;
+  }
+  b = malloc((n + 1) * sizeof(*b));
+  nb = 0;
+  for(i = 0; i < n; i++){
+    if(nb > 0 && !before(&s[i-1], &s[i])){
+      b[nb-1].count++;
+      continue;
+    }
+    b[nb].user = s[i].user;
+    b[nb].name = s[i].user ? s[i].name : "kernel";
+    b[nb].pc = s[i].pc;
+    b[nb].count = 1;
+    nb++;
+  }
+  for(i = 1; i < nb; i++){
+    u = b[i];
+    for(j = i; j > 0 && b[j-1].count < u.count; j--)
+      b[j] = b[j-1];
+    b[j] = u;
+  }
+
+  printf("%d samples, %l lost\n", n, lost);
+  for(i = 0; i < nb; i++)
+    printf("%d\t%s\t%p\n", b[i].count, b[i].name, b[i].pc);
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// Sequential read benchmark for the buffer cache read-ahead.
+// Writes a file, then a second one to push the first out of
+// the buffer cache, so that reading the first back must go to
+// the disk. Then reads it from start to end in small chunks
+// and reports the elapsed ticks. Later passes find it cached.
+//
+// usage: readbench [passes]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NBLOCKS (MAXFILE - 8)  // file size, in blocks; 2*NBLOCKS > NBUF
+#define CHUNK   512            // bytes per read()
+
+char buf[BSIZE];
+
+void
+writefile(char *name)
+{
+  int fd, i;
+
+  fd = open(name, O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0){
+    printf("readbench: cannot create %s\n", name);
+    exit(1);
+  }
+  for(i = 0; i < NBLOCKS; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("readbench: write %s failed\n", name);
+      close(fd);
+      unlink("readbench.tmp");
+      unlink("readbench.fill");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, pass, passes, tot;
+  uint t0, t1;
+
+  passes = 3;
+  if(argc > 1)
+    passes = atoi(argv[1]);
+  if(passes < 1){
+    fprintf(2, "usage: readbench [passes]\n");
+    exit(1);
+  }
+
+  writefile("readbench.tmp");
+  writefile("readbench.fill");
+  unlink("readbench.fill");
+
+  for(pass = 0; pass < passes; pass++){
+    fd = open("readbench.tmp", O_RDONLY);
+    if(fd < 0){
+      printf("readbench: cannot open readbench.tmp\n");
+      exit(1);
+    }
+    tot = 0;
+    t0 = uptime();
+    while((n = read(fd, buf, CHUNK)) > 0)
+      tot += n;
+    t1 = uptime();
+    close(fd);
+    if(tot != NBLOCKS*BSIZE){
+      printf("readbench: read %d bytes, expected %d\n", tot, NBLOCKS*BSIZE);
+      unlink("readbench.tmp");
+      exit(1);
+    }
+    printf("readbench: pass %d: %d blocks in %d ticks\n", pass, NBLOCKS, t1 - t0);
+  }
+
+  unlink("readbench.tmp");
+  exit(0);
+}
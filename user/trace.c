@@ -2,22 +2,126 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/syscall.h"
+#include "kernel/trace.h"
 
+// trace mask command [args ...]
+//
+// Run command with the system calls whose bits are set in
+// mask traced, then print what the kernel recorded, in the
+// order the calls started.
+//
+// The kernel keeps the command's records, and those of its
+// children, for trace alone, and says when none of them is left
+// to make more. trace drains them every tick while the command
+// runs, so that the rings do not overwrite them.
 
-int main(int argc , char* argv[]){
-	if(argc < 3){
-		printf("Usage: trace <syscallNumber> <tracedCommend>\n");
-		exit(1);
-	}
+static char *names[] = {
+  [SYS_fork]    "fork",
+  [SYS_exit]    "exit",
+  [SYS_wait]    "wait",
+  [SYS_pipe]    "pipe",
+  [SYS_read]    "read",
+  [SYS_kill]    "kill",
+  [SYS_exec]    "exec",
+  [SYS_fstat]   "fstat",
+  [SYS_chdir]   "chdir",
+  [SYS_dup]     "dup",
+  [SYS_getpid]  "getpid",
+  [SYS_sbrk]    "sbrk",
+  [SYS_sleep]   "sleep",
+  [SYS_uptime]  "uptime",
+  [SYS_open]    "open",
+  [SYS_write]   "write",
+  [SYS_mknod]   "mknod",
+  [SYS_unlink]  "unlink",
+  [SYS_link]    "link",
+  [SYS_mkdir]   "mkdir",
+  [SYS_close]   "close",
+  [SYS_trace]   "trace",
+  [SYS_sysinfo] "sysinfo",
+  [SYS_fsync]   "fsync",
+  [SYS_splice]  "splice",
+  [SYS_tee]     "tee",
+  [SYS_tracedrain] "tracedrain",
+  [SYS_profile] "profile",
+  [SYS_profdrain] "profdrain",
+  [SYS_lockstats] "lockstats",
+};
 
-	if(trace(atoi(argv[1])) < 0) // write mask into proc struct
-			return -1;
+#define BATCH 64
 
-	// execute 
-	for(int i = 0; i < argc - 1; i++){
-		argv[i] = argv[i+2];
-	}
-	exec(argv[0], argv);
+static struct traceent *ents;
+static int nents, maxents;
+static uint64 lost;
 
-	exit(0);
+// Drain every record the kernel has for us onto ents[].
+// Returns 1 once the command and its children have exited and
+// everything they recorded is on ents[].
+static int
+drain(void)
+{
+  struct traceent *e;
+  int n;
+
+  for(;;){
+    if(nents + BATCH > maxents){
+      maxents = maxents ? 2 * maxents : BATCH;
+      e = malloc(maxents * sizeof(*ents));
+      memmove(e, ents, nents * sizeof(*ents));
+      free(ents);
+      ents = e;
+    }
+    if((n = tracedrain(ents + nents, BATCH, &lost)) <= 0)
+      return n < 0;
+    nents += n;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct traceent *e, t;
+  int pid, i, j;
+  char *name;
+
+  if(argc < 3){
+    fprintf(2, "Usage: trace mask command [args ...]\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(trace(atoi(argv[1])) < 0)
+      exit(1);
+    exec(argv[2], argv + 2);
+    fprintf(2, "trace: exec %s failed\n", argv[2]);
+    exit(1);
+  }
+
+  while(!drain())
+    sleep(1);
+  wait(0);
+
+  // sort by start time, since each CPU's records come out
+  // separately.
+  for(i = 1; i < nents; i++){
+    t = ents[i];
+    for(j = i; j > 0 && ents[j-1].time > t.time; j--)
+      ents[j] = ents[j-1];
+    ents[j] = t;
+  }
+
+  for(e = ents; e < ents + nents; e++){
+    name = e->num < sizeof(names)/sizeof(names[0]) && names[e->num] ? names[e->num] : "?";
+    fprintf(2, "%d: syscall %s(%p, %p, %p) -> %d, %l cycles\n", e->pid, name,
+            e->arg[0], e->arg[1], e->arg[2], (int)e->ret, e->cycles);
+  }
+  if(lost)
+    fprintf(2, "trace: %l records lost\n", lost);
+  exit(0);
 }
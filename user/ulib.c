@@ -32,14 +32,39 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() work a 64-bit word at a
+// time, like the kernel's, once the pointers are 8-byte
+// aligned, and byte by byte for unaligned heads and tails.
+
+#define WSIZE   sizeof(uint64)
+#define WMASK   (WSIZE - 1)
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = (uchar *) dst;
+  uint64 *wd, w;
+
+  while(n > 0 && ((uint64)d & WMASK)){
+    *d++ = c;
+    n--;
+  }
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64 *) d;
+    for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8){
+      wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+      wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (uchar *) wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -100,15 +125,55 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  const uint64 *ws;
+  uint64 *wd;
+  int words;
 
+  // the word loops compare n with sizeof, which is unsigned.
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
+  words = (((uint64)src ^ (uint64)dst) & WMASK) == 0;
   if (src > dst) {
+    if(words){
+      while(n > 0 && ((uint64)dst & WMASK)){
+        *dst++ = *src++;
+        n--;
+      }
+      ws = (const uint64 *) src;
+      wd = (uint64 *) dst;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      src = (const char *) ws;
+      dst = (char *) wd;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(words){
+      while(n > 0 && ((uint64)dst & WMASK)){
+        *--dst = *--src;
+        n--;
+      }
+      ws = (const uint64 *) src;
+      wd = (uint64 *) dst;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE){
+        ws -= 8, wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      src = (const char *) ws;
+      dst = (char *) wd;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -118,7 +183,19 @@ memmove(void *vdst, const void *vsrc, int n)
 int
 memcmp(const void *s1, const void *s2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
+  const uchar *p1 = s1, *p2 = s2;
+
+  if((((uint64)p1 ^ (uint64)p2) & WMASK) == 0){
+    while(n > 0 && ((uint64)p1 & WMASK)){
+      if (*p1 != *p2)
+        return *p1 - *p2;
+      p1++, p2++, n--;
+    }
+    // skip equal words; the bytes below find the difference.
+    while(n >= WSIZE && *(uint64 *)p1 == *(uint64 *)p2){
+      p1 += WSIZE, p2 += WSIZE, n -= WSIZE;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -134,3 +211,47 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Buffered output. printf.c sets flushhook when it starts
+// buffering output; fork(), exit(), exec() and close() call it
+// so that buffered output is written exactly once, and before
+// the file descriptor goes away. close() passes its fd; the
+// others pass -1, for all of them.
+void (*flushhook)(int);
+
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+
+int
+fork(void)
+{
+  if(flushhook)
+    flushhook(-1);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(flushhook)
+    flushhook(-1);
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(flushhook)
+    flushhook(-1);
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  if(flushhook)
+    flushhook(fd);
+  return _close(fd);
+}
@@ -2,89 +2,164 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class memory allocator.
+//
+// The heap is made of page-aligned runs of pages, each starting
+// with a struct run header. Small requests, up to MAXSMALL
+// bytes, are rounded up to a power of two size class; each
+// class carves single-page runs into equal objects and keeps
+// the free ones on a list, so malloc() and free() of a small
+// object are O(1). Larger requests get a run of their own,
+// with the caller's memory just after the header. free() finds
+// an object's run by rounding its address down to a page
+// boundary. Free runs are kept in address order and merged
+// with their neighbours.
 
-typedef long Align;
+#define MINSHIFT 4                      // smallest class is 16 bytes
+#define NCLASS   7                      // classes of 16 .. 1024 bytes
+#define MAXSMALL (1 << (MINSHIFT + NCLASS - 1))
+#define LARGE    NCLASS                 // run.class of a large allocation
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct run {
+  int class;          // size class of the run's objects, or LARGE
+  uint npages;        // length of the run, in pages
+  struct run *next;   // next free run, in address order
 };
 
-typedef union header Header;
+struct object {
+  struct object *next;
+};
 
-static Header base;
-static Header *freep;
+#define HDRSIZE  ((sizeof(struct run) + 15) & ~15)
 
-void
-free(void *ap)
-{
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
-}
+static struct object *freeobj[NCLASS];  // free small objects, per class
+static struct run *freeruns;            // free runs
 
-static Header*
-morecore(uint nu)
+// Return a run of npages pages, from the free runs if one is
+// large enough, or else from sbrk().
+static struct run*
+getrun(uint npages)
 {
+  struct run *r, **rp, *rest;
   char *p;
-  Header *hp;
+  uint64 pad;
+
+  for(rp = &freeruns; (r = *rp) != 0; rp = &r->next){
+    if(r->npages < npages)
+      continue;
+    if(r->npages > npages){
+      // split, leaving the tail on the free list.
+      rest = (struct run*)((char*)r + (uint64)npages*PGSIZE);
+      rest->npages = r->npages - npages;
+      rest->next = r->next;
+      *rp = rest;
+    } else {
+      *rp = r->next;
+    }
+    r->npages = npages;
+    return r;
+  }
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  // sbrk() need not return page-aligned memory.
+  p = sbrk(0);
+  pad = PGROUNDUP((uint64)p) - (uint64)p;
+  if(npages > (0x7fffffff - pad) / PGSIZE)
+    return 0;
+  p = sbrk(pad + npages*PGSIZE);
   if(p == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  r = (struct run*)(p + pad);
+  r->npages = npages;
+  return r;
+}
+
+// Give run r back, merging it with adjacent free runs.
+static void
+putrun(struct run *r)
+{
+  struct run *prev, *next;
+
+  prev = 0;
+  for(next = freeruns; next && next < r; next = next->next)
+    prev = next;
+
+  r->next = next;
+  if(next && (char*)r + (uint64)r->npages*PGSIZE == (char*)next){
+    r->npages += next->npages;
+    r->next = next->next;
+  }
+  if(prev && (char*)prev + (uint64)prev->npages*PGSIZE == (char*)r){
+    prev->npages += r->npages;
+    prev->next = r->next;
+  } else if(prev){
+    prev->next = r;
+  } else {
+    freeruns = r;
+  }
+}
+
+// Carve a fresh page into objects of size class c.
+static int
+refill(int c)
+{
+  struct run *r;
+  struct object *o;
+  char *p, *end;
+  uint size = 1 << (MINSHIFT + c);
+
+  if((r = getrun(1)) == 0)
+    return -1;
+  r->class = c;
+  end = (char*)r + PGSIZE;
+  for(p = (char*)r + HDRSIZE; p + size <= end; p += size){
+    o = (struct object*)p;
+    o->next = freeobj[c];
+    freeobj[c] = o;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  struct run *r;
+  struct object *o;
+
+  if(ap == 0)
+    return;
+  r = (struct run*)PGROUNDDOWN((uint64)ap);
+  if(r->class == LARGE){
+    putrun(r);
+    return;
+  }
+  o = (struct object*)ap;
+  o->next = freeobj[r->class];
+  freeobj[r->class] = o;
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct run *r;
+  struct object *o;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if(nbytes > MAXSMALL){
+    if(nbytes > 0x7fffffff - HDRSIZE - PGSIZE)
+      return 0;
+    if((r = getrun(PGROUNDUP(nbytes + HDRSIZE) / PGSIZE)) == 0)
+      return 0;
+    r->class = LARGE;
+    return (char*)r + HDRSIZE;
   }
+
+  for(c = 0; (1 << (MINSHIFT + c)) < nbytes; c++)
+    ;
+  if(freeobj[c] == 0 && refill(c) < 0)
+    return 0;
+  o = freeobj[c];
+  freeobj[c] = o->next;
+  return o;
 }
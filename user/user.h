@@ -1,6 +1,9 @@
 struct stat;
 struct rtcdate;
 struct sysinfo;
+struct traceent;
+struct profsample;
+struct lockstat;
 
 // system calls
 int fork(void);
@@ -26,6 +29,13 @@ int sleep(int);
 int uptime(void);
 int trace(int);
 int sysinfo(struct sysinfo *);
+int fsync(int);
+int splice(int, int, int);
+int tee(int, int, int);
+int tracedrain(struct traceent*, int, uint64*);
+int profile(int);
+int profdrain(struct profsample*, int, uint64*);
+int lockstats(struct lockstat*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -35,6 +45,7 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -646,6 +647,52 @@ createtest(char *s)
   }
 }
 
+// fsync() waits for the log to commit, from one process or
+// from several at once, and rejects bad file descriptors.
+void
+fsynctest(char *s)
+{
+  int fd, i, pid, xstatus;
+  char name[8];
+
+  if(fsync(-1) != -1 || fsync(NOFILE-1) != -1){
+    printf("%s: fsync of bad fd succeeded\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'f';
+      name[1] = 's';
+      name[2] = '0' + i;
+      name[3] = '\0';
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      if(write(fd, name, 4) != 4 || fsync(fd) != 0){
+        printf("%s: write/fsync %s failed\n", s, name);
+        exit(1);
+      }
+      close(fd);
+      unlink(name);
+      exit(0);
+    }
+  }
+
+  for(i = 0; i < 4; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
 void dirtest(char *s)
 {
   if(mkdir("dir0") < 0){
@@ -724,6 +771,82 @@ exectest(char *s)
 
 }
 
+// splice() a file into a pipe, tee() that pipe into another,
+// and splice() the second pipe into a new file.
+void
+splicetest(char *s)
+{
+  enum { N = 3000 };
+  static char a[N], b[N];
+  int fd, p1[2], p2[2], i, n, tot;
+
+  for(i = 0; i < N; i++)
+    a[i] = 'a' + i % 23;
+  fd = open("splice0", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, a, N) != N){
+    printf("%s: create splice0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("splice0", O_RDONLY);
+  for(tot = 0; tot < N; tot += n){
+    if((n = splice(fd, p1[1], N - tot)) <= 0){
+      printf("%s: splice file to pipe returned %d\n", s, n);
+      exit(1);
+    }
+  }
+  if(splice(fd, p1[1], 1) != 0){
+    printf("%s: splice past end of file\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(splice(p1[1], p1[0], 1) != -1 || tee(p1[0], p1[0], 1) != -1){
+    printf("%s: bad splice succeeded\n", s);
+    exit(1);
+  }
+
+  for(tot = 0; tot < N; tot += n){
+    if((n = tee(p1[0], p2[1], N - tot)) <= 0){
+      printf("%s: tee returned %d\n", s, n);
+      exit(1);
+    }
+    // tee() leaves the data in p1, so read it out to make
+    // room for more.
+    if(read(p1[0], b + tot, n) != n || memcmp(a + tot, b + tot, n) != 0){
+      printf("%s: wrong data after tee\n", s);
+      exit(1);
+    }
+  }
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[1]);
+
+  fd = open("splice1", O_CREATE|O_RDWR);
+  while((n = splice(p2[0], fd, N)) > 0)
+    ;
+  close(fd);
+  close(p2[0]);
+  if(n != 0){
+    printf("%s: splice pipe to file returned %d\n", s, n);
+    exit(1);
+  }
+
+  memset(b, 0, N);
+  fd = open("splice1", O_RDONLY);
+  if(fd < 0 || read(fd, b, N) != N || memcmp(a, b, N) != 0){
+    printf("%s: wrong data in splice1\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("splice0");
+  unlink("splice1");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2008,9 +2131,10 @@ dirfile(char *s)
 void
 iref(char *s)
 {
+  enum { N = 51 };  // more than the old fixed inode table held
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -2032,7 +2156,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2080,6 +2204,379 @@ forktest(char *s)
   }
 }
 
+// fork() shares memory copy-on-write. A process using most
+// of physical memory must still be able to fork, and writes
+// by either process must not be seen by the other.
+void
+cowfork(char *s)
+{
+  struct sysinfo info;
+  uint64 sz;
+  char *a, *p;
+  int pid, xstatus;
+
+  if(sysinfo(&info) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  sz = PGROUNDDOWN(info.freemem / 3 * 2);
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + sz; p += PGSIZE)
+    *(int*)p = 1;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + sz; p += 16*PGSIZE)
+      *(int*)p = 2;
+    for(p = a; p < a + sz; p += PGSIZE){
+      if(*(int*)p != ((p - a) % (16*PGSIZE) == 0 ? 2 : 1)){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + sz; p += PGSIZE){
+    if(*(int*)p != 1){
+      printf("%s: parent sees child's write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-sz);
+}
+
+// the kernel maps 2MB-aligned runs of untouched heap with
+// megapages. shrinking the heap part way through one, and
+// fork(), must split them without losing data.
+void
+megapages(char *s)
+{
+  char *a, *top, *p;
+  uint64 pad;
+  int pid, xstatus;
+
+  // grow the heap to a 2MB boundary, then by 4MB.
+  top = sbrk(0);
+  pad = (((uint64)top + (1L<<21) - 1) & ~((1L<<21) - 1)) - (uint64)top;
+  a = sbrk(pad + (4L<<20));
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a += pad;
+  for(p = a; p < a + (4L<<20); p += PGSIZE)
+    *(int*)p = (p - a) / PGSIZE;
+
+  // drop the top 1MB, half of the second megapage.
+  sbrk(-(1L<<20));
+  for(p = a; p < a + (3L<<20); p += PGSIZE){
+    if(*(int*)p != (p - a) / PGSIZE){
+      printf("%s: wrong value after shrinking\n", s);
+      exit(1);
+    }
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + (3L<<20); p += PGSIZE){
+      if(*(int*)p != (p - a) / PGSIZE){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+      *(int*)p = -1;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(p = a; p < a + (3L<<20); p += PGSIZE){
+    if(*(int*)p != (p - a) / PGSIZE){
+      printf("%s: parent sees child's write\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(pad + (3L<<20)));
+}
+
+// system calls copy to and from user memory directly, through
+// the process's kernel page table. the copies must fault in
+// lazily allocated and copy-on-write pages part way through,
+// and must fail on the stack guard page.
+void
+ucopytest(char *s)
+{
+  static char data[3*PGSIZE];
+  char *a, *g;
+  int fds[2], pid, xstatus, i, n;
+
+  a = sbrk(4*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = i % 251;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  // read() into untouched heap, starting part way into a page.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if(write(fds[1], data, sizeof(data)) != sizeof(data))
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  for(i = 0; i < sizeof(data); i += n){
+    n = read(fds[0], a + 100 + i, sizeof(data) - i);
+    if(n <= 0){
+      printf("%s: read into lazy page failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || memcmp(a + 100, data, sizeof(data)) != 0){
+    printf("%s: read into lazy page got wrong data\n", s);
+    exit(1);
+  }
+
+  // a child's read() into memory it shares copy-on-write
+  // with its parent must not change the parent's copy.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    memset(data, 'x', PGSIZE);
+    if(write(fds[1], data, PGSIZE) != PGSIZE)
+      exit(1);
+    for(i = 0; i < PGSIZE; i += n)
+      if((n = read(fds[0], a + 100 + i, PGSIZE - i)) <= 0)
+        exit(1);
+    if(a[100] != 'x' || a[100 + PGSIZE - 1] != 'x')
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  close(fds[0]);
+  close(fds[1]);
+  if(xstatus != 0){
+    printf("%s: read into copy-on-write page failed\n", s);
+    exit(1);
+  }
+  if(memcmp(a + 100, data, sizeof(data)) != 0){
+    printf("%s: parent sees child's read\n", s);
+    exit(1);
+  }
+
+  // the page below the stack is not user memory.
+  g = (char *) (PGROUNDDOWN(r_sp()) - PGSIZE);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], g, 1) > 0){
+    printf("%s: write() from guard page succeeded\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "x", 1) != 1 || read(fds[0], g, 1) > 0){
+    printf("%s: read() into guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-4*PGSIZE);
+}
+
+// shrinking the heap part way into a megapage has to split it,
+// which takes a page. with memory exhausted, sbrk() must fail
+// cleanly rather than panic, and work once memory is back.
+void
+megashrink(char *s)
+{
+  char *a, *top, *p, c;
+  uint64 pad, n;
+  int fds[2];
+
+  top = sbrk(0);
+  pad = (((uint64)top + (1L<<21) - 1) & ~((1L<<21) - 1)) - (uint64)top;
+  a = sbrk(pad + (2L<<20));
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a += pad;
+  for(p = a; p < a + (2L<<20); p += PGSIZE)
+    *(int*)p = (p - a) / PGSIZE;
+
+  // use up memory. write() faults in each page of the heap,
+  // and fails instead of killing us when there is no more.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  top = sbrk(0);
+  n = 160L<<20;
+  if(sbrk(n) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = top; p < top + n; p += PGSIZE){
+    if(write(fds[1], p, 1) != 1)
+      break;
+    read(fds[0], &c, 1);
+  }
+  if(p == top + n){
+    printf("%s: memory did not run out\n", s);
+    exit(1);
+  }
+
+  // cut into the megapage, and the rest of the heap with it.
+  // this may fail, but it must not lose anything.
+  sbrk(-(n + (1L<<20)));
+
+  // give the memory back, then shrink for real.
+  if(sbrk(0) == top + n)
+    sbrk(-n);
+  if(sbrk(0) == a + (2L<<20) && sbrk(-(1L<<20)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed with memory free\n", s);
+    exit(1);
+  }
+  if(sbrk(0) != a + (1L<<20)){
+    printf("%s: wrong size after shrinking\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + (1L<<20); p += PGSIZE){
+    if(*(int*)p != (p - a) / PGSIZE){
+      printf("%s: wrong value after shrinking\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-(pad + (1L<<20)));
+}
+
+// sysinfo() counts must follow what the system does.
+void
+sysinfotest(char *s)
+{
+  struct sysinfo before, after;
+  uint64 nswitch0, nswitch1;
+  int fds[2], pid, fd, i;
+  char *a, buf[BSIZE];
+
+  if(sysinfo(&before) < 0){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+
+  // a child blocked on a pipe counts as a process.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], buf, 1);
+    exit(0);
+  }
+  close(fds[0]);
+  sysinfo(&after);
+  if(after.nproc != before.nproc + 1){
+    printf("%s: nproc %d, expected %d\n", s, (int)after.nproc, (int)before.nproc + 1);
+    exit(1);
+  }
+  close(fds[1]);
+  wait(0);
+  sysinfo(&after);
+  if(after.nproc != before.nproc){
+    printf("%s: nproc %d after wait, expected %d\n", s, (int)after.nproc, (int)before.nproc);
+    exit(1);
+  }
+
+  // touched heap pages come out of free memory.
+  sysinfo(&before);
+  a = sbrk(10*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++)
+    a[i*PGSIZE] = 1;
+  sysinfo(&after);
+  if(after.freemem > before.freemem - 10*PGSIZE){
+    printf("%s: freemem did not drop\n", s);
+    exit(1);
+  }
+  sbrk(-10*PGSIZE);
+
+  // reading a file goes through the buffer cache.
+  sysinfo(&before);
+  fd = open("README", 0);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  sleep(1);
+  sysinfo(&after);
+  if(after.bcachehit + after.bcachemiss <= before.bcachehit + before.bcachemiss){
+    printf("%s: buffer cache counts did not change\n", s);
+    exit(1);
+  }
+  if(after.diskread < before.diskread || after.diskwrite < before.diskwrite){
+    printf("%s: disk counts went backwards\n", s);
+    exit(1);
+  }
+  nswitch0 = nswitch1 = 0;
+  for(i = 0; i < NCPU; i++){
+    nswitch0 += before.nswitch[i];
+    nswitch1 += after.nswitch[i];
+  }
+  if(nswitch1 <= nswitch0){
+    printf("%s: no context switches counted\n", s);
+    exit(1);
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2839,6 +3336,11 @@ main(int argc, char *argv[])
     {twochildren, "twochildren"},
     {forkfork, "forkfork"},
     {forkforkfork, "forkforkfork"},
+    {cowfork, "cowfork"},
+    {sysinfotest, "sysinfotest"},
+    {megapages, "megapages"},
+    {megashrink, "megashrink"},
+    {ucopytest, "ucopytest"},
     {argptest, "argptest"},
     {createdelete, "createdelete"},
     {linkunlink, "linkunlink"},
@@ -2866,11 +3368,13 @@ main(int argc, char *argv[])
     {writetest, "writetest"},
     {writebig, "writebig"},
     {createtest, "createtest"},
+    {fsynctest, "fsynctest"},
     {openiputtest, "openiput"},
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {splicetest, "splicetest"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
@@ -6,10 +6,15 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# ulib.c wraps these calls so that buffered output is flushed
+# first; their stubs get a leading underscore.
+my %wrapped = map { $_ => 1 } qw(fork exit exec close);
+
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = $wrapped{$name} ? "_${name}" : $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
@@ -38,3 +43,10 @@ entry("sleep");
 entry("uptime");
 entry("trace");
 entry("sysinfo");
+entry("fsync");
+entry("splice");
+entry("tee");
+entry("tracedrain");
+entry("profile");
+entry("profdrain");
+entry("lockstats");